@@ -0,0 +1,224 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <readline/history.h>
+#include <glib.h>
+
+#include "cmdhistory.h"
+
+/*
+ * The history holds no duplicates, a repeated line moves to the end; the index
+ * maps the lines to their entries, so only a repeat needs the position of the
+ * old entry. It is looked for from the end, where the repeats mostly are, and
+ * removed right away, so that it never turns up when going through the
+ * history; readline keeps the history in an array, so the removal shifts at
+ * most CMD_HISTORY_SIZE pointers.
+ *
+ * The file is only ever appended to, one line per command, so a line can be
+ * there several times; the last occurrence is the current one. Once there are
+ * enough stale lines in it, the file is rewritten from the history.
+ */
+#define HISTORY_SLACK CMD_HISTORY_SIZE
+
+static char       *hist_file = NULL;
+static GHashTable *hist_index = NULL;
+static int         hist_file_lines = 0;
+
+static gboolean
+entry_is_live (HIST_ENTRY *e)
+{
+  return g_hash_table_lookup (hist_index, e->line) == e;
+}
+
+static void
+remove_entry (int pos)
+{
+  HIST_ENTRY *e;
+
+  if (!(e = remove_history (pos)))
+    return;
+
+  if (entry_is_live (e))
+    g_hash_table_remove (hist_index, e->line);
+
+  free_history_entry (e);
+}
+
+static int
+entry_pos (HIST_ENTRY *e)
+{
+  HIST_ENTRY **list = history_list ();
+  int          i;
+
+  for (i = history_length - 1; i >= 0; i--)
+    if (list[i] == e)
+      return i;
+
+  return -1;
+}
+
+/*
+ * Rebuilds the history without the entries the index does not point to, i.e.,
+ * the older copies of the lines read from the file, keeping at most
+ * CMD_HISTORY_SIZE of the most recent lines.
+ */
+static void
+purge (void)
+{
+  HIST_ENTRY **list = history_list ();
+  GPtrArray   *lines;
+  guint        i;
+
+  if (!list)
+    return;
+
+  lines = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < (guint) history_length; i++)
+    if (entry_is_live (list[i]))
+      g_ptr_array_add (lines, g_strdup (list[i]->line));
+
+  g_hash_table_remove_all (hist_index);
+  clear_history ();
+
+  i = lines->len > CMD_HISTORY_SIZE ? lines->len - CMD_HISTORY_SIZE : 0;
+
+  for (; i < lines->len; i++)
+    {
+      char *line = g_ptr_array_index (lines, i);
+
+      add_history (line);
+      g_hash_table_insert (hist_index, g_strdup (line),
+                           history_list ()[history_length - 1]);
+    }
+
+  g_ptr_array_free (lines, TRUE);
+}
+
+/*
+ * Rewrites the file from the history; the new file is written next to the old
+ * one and moved over it, so we never end up with a truncated history.
+ */
+static void
+compact (void)
+{
+  char *tmp = g_strconcat (hist_file, ".tmp", NULL);
+  int   err;
+
+  if ((err = write_history (tmp)) || rename (tmp, hist_file) < 0)
+    {
+      g_warning ("Failed to write %s: %s", hist_file,
+                 strerror (err ? err : errno));
+      unlink (tmp);
+    }
+  else
+    hist_file_lines = history_length;
+
+  g_free (tmp);
+}
+
+/*
+ * Loads the history from path; commands added later are appended to the file.
+ * With NULL path the history is not persisted.
+ */
+void
+cmdhistory_load (const char *path)
+{
+  int dups = 0;
+  int i;
+
+  using_history ();
+
+  hist_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  if (!path)
+    return;
+
+  hist_file = g_strdup (path);
+
+  if (read_history (hist_file))
+    {
+      /* no history yet, append_history() needs the file to exist */
+      compact ();
+      return;
+    }
+
+  hist_file_lines = history_length;
+
+  /* the last occurrence of a line is the live one */
+  for (i = history_length - 1; i >= 0; i--)
+    {
+      HIST_ENTRY *e = history_list ()[i];
+
+      if (g_hash_table_lookup (hist_index, e->line))
+        dups++;
+      else
+        g_hash_table_insert (hist_index, g_strdup (e->line), e);
+    }
+
+  /* done in one pass, before the history is ever shown */
+  if (dups || history_length > CMD_HISTORY_SIZE)
+    purge ();
+
+  if (hist_file_lines - history_length >= HISTORY_SLACK)
+    compact ();
+}
+
+void
+cmdhistory_add (const char *line)
+{
+  HIST_ENTRY *e;
+
+  g_return_if_fail (hist_index);
+
+  if ((e = g_hash_table_lookup (hist_index, line)))
+    {
+      int pos;
+
+      /* already the last one, nothing moves */
+      if (e == history_list ()[history_length - 1])
+        return;
+
+      if ((pos = entry_pos (e)) >= 0)
+        remove_entry (pos);
+    }
+  else
+    while (g_hash_table_size (hist_index) >= CMD_HISTORY_SIZE)
+      remove_entry (0);
+
+  add_history (line);
+
+  e = history_list ()[history_length - 1];
+  g_hash_table_insert (hist_index, g_strdup (e->line), e);
+
+  if (!hist_file)
+    return;
+
+  if (!append_history (1, hist_file))
+    hist_file_lines++;
+
+  if (hist_file_lines - history_length >= HISTORY_SLACK)
+    compact ();
+}
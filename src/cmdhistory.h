@@ -0,0 +1,28 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_CMDHISTORY_H
+#define GUACA_CMDHISTORY_H
+
+#include <glib.h>
+
+/* number of lines kept in the history */
+#define CMD_HISTORY_SIZE 500
+
+void cmdhistory_load (const char *path);
+void cmdhistory_add  (const char *line);
+
+#endif
@@ -0,0 +1,548 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <glib.h>
+
+#include "main.h"
+#include "command.h"
+
+/*
+ * The commands are held in a trie with a node per character; each node knows
+ * how many commands there are below it, so a prefix resolves in a single walk
+ * down the trie, and when it is ambiguous the candidates are simply the
+ * commands of the subtree. The children are kept sorted, so a walk of the
+ * subtree lists the commands in order.
+ *
+ * Commands with sub-commands have a trie of their own hanging off the node
+ * where their name ends.
+ */
+typedef struct _CmdNode CmdNode;
+
+struct _CmdNode
+{
+  char            c;
+  guint           n_cmds; /* commands in this subtree */
+  const GuacaCmd *cmd;    /* command ending at this node */
+  CmdNode        *sub;    /* trie of the sub-commands of cmd */
+  CmdNode        *child;
+  CmdNode        *next;
+};
+
+static CmdNode            root = {0,};
+static GuacaCmdFilterFunc cmd_filter = NULL;
+
+/*
+ * The command in progress; a command that has to wait, e.g., for a D-Bus reply
+ * or for user input, defers its completion and reports the result later.
+ */
+static gboolean           cmd_running = FALSE;
+static gboolean           cmd_in_func = FALSE;
+static gboolean           cmd_deferred = FALSE;
+static gboolean           cmd_finished = FALSE;
+static gboolean           cmd_success = FALSE;
+static GuacaCancelFunc    cmd_cancel = NULL;
+static gpointer           cmd_cancel_data = NULL;
+static GuacaCmdDoneFunc   cmd_done = NULL;
+static gpointer           cmd_done_data = NULL;
+
+static CmdNode *
+node_child (CmdNode *node, char c, gboolean create)
+{
+  CmdNode **p = &node->child;
+  CmdNode  *n;
+
+  while (*p && (*p)->c < c)
+    p = &(*p)->next;
+
+  if (*p && (*p)->c == c)
+    return *p;
+
+  if (!create)
+    return NULL;
+
+  n = g_slice_new0 (CmdNode);
+  n->c    = c;
+  n->next = *p;
+  *p      = n;
+
+  return n;
+}
+
+static CmdNode *
+node_walk (CmdNode *trie, const char *word, gsize len)
+{
+  CmdNode *node = trie;
+  gsize    i;
+
+  for (i = 0; i < len && node; i++)
+    node = node_child (node, word[i], FALSE);
+
+  return node;
+}
+
+static CmdNode *
+node_insert (CmdNode *trie, const GuacaCmd *cmd)
+{
+  CmdNode    *node = trie;
+  const char *p;
+
+  for (p = cmd->cmd; *p; p++)
+    node = node_child (node, *p, TRUE);
+
+  if (node->cmd)
+    {
+      g_warning ("Command '%s' registered twice", cmd->cmd);
+      return node;
+    }
+
+  node->cmd = cmd;
+
+  /* account for the new command all the way down from the root */
+  for (node = trie, p = cmd->cmd; node; node = node_child (node, *p++, FALSE))
+    {
+      node->n_cmds++;
+
+      if (!*p)
+        break;
+    }
+
+  return node;
+}
+
+/*
+ * Matches the word against the trie; either the word is a command, or a
+ * prefix of exactly one command. Returns NULL if there is no match, setting
+ * ambiguous if that is because the prefix matches several commands.
+ */
+static CmdNode *
+trie_match (CmdNode *trie, const char *word, gsize len, gboolean *ambiguous)
+{
+  CmdNode *node = node_walk (trie, word, len);
+
+  *ambiguous = FALSE;
+
+  if (!node || !len)
+    return NULL;
+
+  if (node->cmd)
+    return node;
+
+  if (node->n_cmds > 1)
+    {
+      *ambiguous = TRUE;
+      return NULL;
+    }
+
+  /* the only command in the subtree */
+  while (!node->cmd)
+    node = node->child;
+
+  return node;
+}
+
+static void
+node_collect (CmdNode *node, GPtrArray *cmds)
+{
+  CmdNode *n;
+
+  if (node->cmd)
+    g_ptr_array_add (cmds, (gpointer) node->cmd);
+
+  for (n = node->child; n; n = n->next)
+    node_collect (n, cmds);
+}
+
+static void
+report_ambiguous (CmdNode *trie, const char *word, gsize len)
+{
+  GPtrArray *cmds = g_ptr_array_new ();
+  guint      i;
+
+  node_collect (node_walk (trie, word, len), cmds);
+
+  output ("Ambiguous command '%.*s', could be:", (int) len, word);
+
+  for (i = 0; i < cmds->len; i++)
+    {
+      const GuacaCmd *cmd = g_ptr_array_index (cmds, i);
+
+      if (!(cmd->flags & C_HIDDEN))
+        output (" %s", cmd->cmd);
+    }
+
+  output ("\n");
+
+  g_ptr_array_free (cmds, TRUE);
+}
+
+/*
+ * Resolves the command (and sub-command) names at the start of the first len
+ * bytes of line. On success returns the node of the command, and sets
+ * args to the start of the arguments; the sub-command trie is returned in
+ * trie if the arguments could still be a sub-command name.
+ *
+ * In quiet mode, used for completion, nothing is reported, and a line without
+ * any complete command resolves to NULL with the top level trie.
+ */
+static CmdNode *
+command_resolve (const char  *line,
+                 gsize        len,
+                 gboolean     quiet,
+                 const char **args,
+                 CmdNode    **trie)
+{
+  const char *end = line + len;
+  const char *p = line;
+  CmdNode    *found = NULL;
+  CmdNode    *t = &root;
+
+  if (trie)
+    *trie = NULL;
+
+  while (t)
+    {
+      const char *word;
+      CmdNode    *node;
+      gboolean    ambiguous = FALSE;
+      int         n;
+
+      while (p < end && isspace (*p))
+        p++;
+
+      for (word = p; p < end && *p && !isspace (*p); p++);
+
+      n = p - word;
+
+      /* when completing, the word at the very end is the one being typed */
+      if (p == end && quiet)
+        {
+          p = word;
+          break;
+        }
+
+      if ((node = trie_match (t, word, n, &ambiguous)))
+        {
+          found = node;
+          t     = node->sub;
+          continue;
+        }
+
+      p = word;
+
+      /* not a sub-command, so it is an argument of the parent */
+      if (found && found->cmd->func)
+        {
+          t = NULL;
+          break;
+        }
+
+      if (quiet)
+        return NULL;
+
+      if (ambiguous)
+        report_ambiguous (t, word, n);
+      else if (found)
+        output ("'%s' needs one of its sub-commands\n", found->cmd->cmd);
+      else
+        output ("Unknown command '%.*s'\n", n, word);
+
+      return NULL;
+    }
+
+  while (p < end && isspace (*p))
+    p++;
+
+  if (args)
+    *args = p;
+
+  if (trie)
+    *trie = t;
+
+  return found;
+}
+
+/*
+ * Registers the commands; parent is the name of the command they are
+ * sub-commands of, or NULL for top level commands. The commands are not
+ * copied, and have to remain valid.
+ */
+void
+command_register (const char *parent, const GuacaCmd *cmds, guint n_cmds)
+{
+  CmdNode *trie = &root;
+  guint    i;
+
+  if (parent)
+    {
+      CmdNode *node;
+
+      for (node = &root; *parent; parent++)
+        if (!(node = node_child (node, *parent, FALSE)))
+          break;
+
+      if (!node || !node->cmd)
+        {
+          g_warning ("Unknown parent command for '%s'", cmds[0].cmd);
+          return;
+        }
+
+      if (!node->sub)
+        node->sub = g_slice_new0 (CmdNode);
+
+      trie = node->sub;
+    }
+
+  for (i = 0; i < n_cmds; i++)
+    node_insert (trie, &cmds[i]);
+}
+
+/*
+ * Finds the command for the line; reports unknown and ambiguous commands.
+ */
+const GuacaCmd *
+command_lookup (char *line, char **args)
+{
+  const char *a;
+  CmdNode    *node;
+
+  if (!(node = command_resolve (line, strlen (line), FALSE, &a, NULL)))
+    return NULL;
+
+  *args = (char *) a;
+
+  return node->cmd;
+}
+
+static void
+node_foreach (CmdNode             *node,
+              GString             *name,
+              GuacaCmdForeachFunc  func,
+              gpointer             data)
+{
+  CmdNode *n;
+
+  if (node->cmd)
+    {
+      gsize len = name->len;
+
+      g_string_append (name, node->cmd->cmd);
+      func (name->str, node->cmd, data);
+
+      if (node->sub)
+        {
+          g_string_append_c (name, ' ');
+          node_foreach (node->sub, name, func, data);
+        }
+
+      g_string_truncate (name, len);
+    }
+
+  for (n = node->child; n; n = n->next)
+    node_foreach (n, name, func, data);
+}
+
+/*
+ * Calls func for all the commands in order, with each command followed by its
+ * sub-commands; name is the full name, including that of the parent.
+ */
+void
+command_foreach (GuacaCmdForeachFunc func, gpointer data)
+{
+  GString *name = g_string_new (NULL);
+
+  node_foreach (&root, name, func, data);
+
+  g_string_free (name, TRUE);
+}
+
+/*
+ * Sets the function deciding which commands are available, and so offered for
+ * completion.
+ */
+void
+command_set_filter (GuacaCmdFilterFunc filter)
+{
+  cmd_filter = filter;
+}
+
+/*
+ * Readline generator for the whole command line; text is the word being
+ * completed, which starts at start in line. Offers the names of the matching
+ * commands or sub-commands, and then whatever the completion function of the
+ * command has to offer.
+ */
+char *
+command_complete (const char *line, gsize start, const char *text, int state)
+{
+  static GPtrArray           *matches = NULL;
+  static GuacaCompletionFunc  complete = NULL;
+  static guint                i = 0;
+  static int                  sub_state = 0;
+
+  if (!state)
+    {
+      CmdNode *node, *trie;
+
+      if (!matches)
+        matches = g_ptr_array_new ();
+
+      g_ptr_array_set_size (matches, 0);
+      complete  = NULL;
+      i         = 0;
+      sub_state = 0;
+
+      if ((node = command_resolve (line, start, TRUE, NULL, &trie)))
+        complete = node->cmd->complete;
+
+      if (trie && (node = node_walk (trie, text, strlen (text))))
+        node_collect (node, matches);
+    }
+
+  while (i < matches->len)
+    {
+      const GuacaCmd *cmd = g_ptr_array_index (matches, i++);
+
+      if ((cmd->flags & C_HIDDEN) || (cmd_filter && !cmd_filter (cmd->flags)))
+        continue;
+
+      return strdup (cmd->cmd);
+    }
+
+  if (complete)
+    return complete (text, sub_state++);
+
+  return NULL;
+}
+
+static void
+command_finish (gboolean success)
+{
+  GuacaCmdDoneFunc done = cmd_done;
+  gpointer         data = cmd_done_data;
+
+  cmd_running     = FALSE;
+  cmd_deferred    = FALSE;
+  cmd_cancel      = NULL;
+  cmd_cancel_data = NULL;
+  cmd_done        = NULL;
+  cmd_done_data   = NULL;
+
+  if (done)
+    done (success, data);
+}
+
+/*
+ * Runs the command on the line, calling done with the result once the command
+ * has finished, which may be before this returns. The line has to remain
+ * valid until then, as the command is passed a pointer into it.
+ */
+void
+command_run (char *line, GuacaCmdDoneFunc done, gpointer data)
+{
+  const GuacaCmd *cmd;
+  char           *args;
+  gboolean        success;
+
+  g_return_if_fail (!cmd_running);
+
+  cmd_running   = TRUE;
+  cmd_deferred  = FALSE;
+  cmd_finished  = FALSE;
+  cmd_done      = done;
+  cmd_done_data = data;
+
+  if (!(cmd = command_lookup (line, &args)))
+    success = FALSE;
+  else if (cmd_filter && !cmd_filter (cmd->flags))
+    {
+      output ("Sorry mate, can't let you do that.\n");
+      success = FALSE;
+    }
+  else
+    {
+      cmd_in_func = TRUE;
+      success = cmd->func (args);
+      cmd_in_func = FALSE;
+
+      if (cmd_deferred)
+        {
+          if (!cmd_finished)
+            return;
+
+          success = cmd_success;
+        }
+    }
+
+  command_finish (success);
+}
+
+gboolean
+command_is_running (void)
+{
+  return cmd_running;
+}
+
+/*
+ * Called by the command function to say the command carries on from the main
+ * loop; the command then has to call command_done() when it has finished.
+ * cancel, if set, is called when the user interrupts the command, and should
+ * lead to command_done() too.
+ */
+void
+command_defer (GuacaCancelFunc cancel, gpointer data)
+{
+  g_return_if_fail (cmd_in_func);
+
+  cmd_deferred    = TRUE;
+  cmd_cancel      = cancel;
+  cmd_cancel_data = data;
+}
+
+void
+command_done (gboolean success)
+{
+  g_return_if_fail (cmd_running && cmd_deferred && !cmd_finished);
+
+  cmd_finished = TRUE;
+  cmd_success  = success;
+
+  /* finished before the command function returned, command_run() deals */
+  if (cmd_in_func)
+    return;
+
+  command_finish (success);
+}
+
+/*
+ * Asks the command in progress to stop; returns FALSE if it cannot be
+ * interrupted.
+ */
+gboolean
+command_cancel (void)
+{
+  if (!cmd_running || !cmd_cancel)
+    return FALSE;
+
+  cmd_cancel (cmd_cancel_data);
+  return TRUE;
+}
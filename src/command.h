@@ -0,0 +1,84 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_COMMAND_H
+#define GUACA_COMMAND_H
+
+#include <glib.h>
+
+/*
+ * C_DEBUG:  only shown in help in debug build, but no restrictions on
+ *           availability per se.
+ *
+ * C_HIDDEN: never shown in help output
+ *
+ * C_SHELL:  in non-debug build only available if running under shell; in
+ *           debug build all commands are always available.
+ */
+enum
+{
+  C_NONE   = 0,
+  C_DEBUG  = 0x00000001,
+  C_HIDDEN = 0x00000002,
+  C_SHELL  = 0x00000004,
+};
+
+/*
+ * The command function is passed the arguments, i.e., the rest of the line
+ * following the command (and sub-command) name.
+ */
+typedef gboolean (*GuacaCmdFunc)        (char *args);
+typedef char *   (*GuacaCompletionFunc) (const char *text, int state);
+typedef gboolean (*GuacaCmdFilterFunc)  (guint flags);
+typedef void     (*GuacaCancelFunc)     (gpointer data);
+typedef void     (*GuacaCmdDoneFunc)    (gboolean success, gpointer data);
+
+/*
+ * complete: optional readline generator for the command arguments
+ */
+typedef struct
+{
+  const char          *cmd;
+  const char          *args;
+  const char          *help;
+  GuacaCmdFunc         func;
+  guint                flags;
+  GuacaCompletionFunc  complete;
+} GuacaCmd;
+
+typedef void (*GuacaCmdForeachFunc) (const char     *name,
+                                     const GuacaCmd *cmd,
+                                     gpointer        data);
+
+void            command_register   (const char     *parent,
+                                    const GuacaCmd *cmds,
+                                    guint           n_cmds);
+const GuacaCmd *command_lookup     (char *line, char **args);
+void            command_foreach    (GuacaCmdForeachFunc func, gpointer data);
+void            command_set_filter (GuacaCmdFilterFunc filter);
+char           *command_complete   (const char *line,
+                                    gsize       start,
+                                    const char *text,
+                                    int         state);
+void            command_run        (char             *line,
+                                    GuacaCmdDoneFunc  done,
+                                    gpointer          data);
+gboolean        command_is_running (void);
+void            command_defer      (GuacaCancelFunc cancel, gpointer data);
+void            command_done       (gboolean success);
+gboolean        command_cancel     (void);
+
+#endif
@@ -1,16 +0,0 @@
-static const char connman_agent_introspection[] = 
-	"<node>"
-	"  <interface name='net.connman.Agent'>"
-	"    <method name='ReportError'>"
-	"      <arg name='service' direction='in' type='o'/>"
-	"      <arg name='error' direction='in' type='s'/>"
-	"    </method>"
-	""
-	"    <method name='RequestInput'>"
-	"      <arg name='service' direction='in' type='o'/>"
-	"      <arg name='fields' direction='in' type='a{sv}'/>"
-	"      <arg name='input' direction='out' type='a{sv}'/>"
-	"    </method>"
-	"  </interface>"
-	"</node>"
-;
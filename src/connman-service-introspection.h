@@ -1,31 +0,0 @@
-static const char connman_service_introspection[] = 
-	"<node>"
-	"	<interface name=\"net.connman.Service\">"
-	"		<method name=\"GetProperties\">"
-	"			<arg type=\"a{sv}\" direction=\"out\"/>"
-	"		</method>"
-	"		<method name=\"SetProperty\">"
-	"			<arg type=\"s\" direction=\"in\"/>"
-	"			<arg type=\"v\" direction=\"in\"/>"
-	"		</method>"
-	"		<method name=\"ClearProperty\">"
-	"			<arg type=\"s\" direction=\"in\"/>"
-	"		</method>"
-	"		<method name=\"Connect\"/>"
-	"		<method name=\"Disconnect\"/>"
-	"		<method name=\"Remove\"/>"
-	"		<method name=\"MoveBefore\">"
-	"			<arg type=\"o\" direction=\"in\"/>"
-	"		</method>"
-	"		<method name=\"MoveAfter\">"
-	"			<arg type=\"o\" direction=\"in\"/>"
-	"		</method>"
-	"		<method name=\"ResetCounters\"/>"
-	"		<signal name=\"PropertyChanged\">"
-	"			<arg type=\"s\"/>"
-	"			<arg type=\"v\"/>"
-	"		</signal>"
-	"	</interface>"
-	"</node>"
-	""
-;
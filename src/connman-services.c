@@ -0,0 +1,542 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <glib.h>
+
+#include "connman-services.h"
+
+/* indexed by ServiceState */
+static const char *state_names[] =
+{
+  NULL,
+  "idle",
+  "failure",
+  "association",
+  "configuration",
+  "ready",
+  "disconnect",
+  "online",
+};
+
+/* indexed by the bit of the SERVICE_SECURITY_ flag */
+static const char *security_names[] =
+{
+  "none",
+  "wep",
+  "psk",
+  "ieee8021x",
+  "wps",
+};
+
+static ServiceState
+state_from_string (const char *state)
+{
+  guint i;
+
+  for (i = 1; i < G_N_ELEMENTS (state_names); i++)
+    if (!strcmp (state, state_names[i]))
+      return i;
+
+  return SERVICE_STATE_UNKNOWN;
+}
+
+static guint
+security_from_variant (GVariant *v)
+{
+  GVariantIter  iter;
+  const char   *s;
+  guint         security = 0;
+  guint         i;
+
+  g_variant_iter_init (&iter, v);
+  while (g_variant_iter_next (&iter, "&s", &s))
+    for (i = 0; i < G_N_ELEMENTS (security_names); i++)
+      if (!strcmp (s, security_names[i]))
+        {
+          security |= 1 << i;
+          break;
+        }
+
+  return security;
+}
+
+static void
+service_free (ConnmanService *s)
+{
+  g_free (s->name);
+  g_free (s->path);
+  g_slice_free (ConnmanService, s);
+}
+
+/*
+ * Drops the service from the name index; if it was the one indexed, the next
+ * service of the same name takes its place.
+ */
+static void
+name_unindex (ConnmanServices *table, ConnmanService *s)
+{
+  GPtrArray *a = table->services;
+  guint      i;
+
+  if (g_hash_table_lookup (table->by_name, s->name) != s)
+    return;
+
+  g_hash_table_remove (table->by_name, s->name);
+
+  for (i = 0; i < a->len; i++)
+    {
+      ConnmanService *t = g_ptr_array_index (a, i);
+
+      if (t != s && !g_strcmp0 (t->name, s->name))
+        {
+          g_hash_table_insert (table->by_name, t->name, t);
+          break;
+        }
+    }
+}
+
+static gboolean
+service_set_name (ConnmanServices *table,
+                  ConnmanService  *s,
+                  const char      *name)
+{
+  if (!g_strcmp0 (s->name, name))
+    return FALSE;
+
+  if (s->name)
+    name_unindex (table, s);
+
+  g_free (s->name);
+  s->name = g_strdup (name);
+
+  if (name && !g_hash_table_lookup (table->by_name, name))
+    g_hash_table_insert (table->by_name, s->name, s);
+
+  return TRUE;
+}
+
+ConnmanServices *
+connman_services_new (void)
+{
+  ConnmanServices *table = g_slice_new0 (ConnmanServices);
+
+  table->services =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) service_free);
+
+  /* the keys are owned by the services */
+  table->by_path = g_hash_table_new (g_str_hash, g_str_equal);
+  table->by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
+  return table;
+}
+
+void
+connman_services_free (ConnmanServices *table)
+{
+  if (!table)
+    return;
+
+  g_hash_table_destroy (table->by_name);
+  g_hash_table_destroy (table->by_path);
+  g_ptr_array_free (table->services, TRUE);
+
+  g_slice_free (ConnmanServices, table);
+}
+
+/*
+ * Applies the properties in the a{sv} dictionary to the service; properties
+ * not in the dictionary are left as they are. Returns whether any of the
+ * properties we keep changed.
+ */
+static gboolean
+service_apply (ConnmanServices *table, ConnmanService *s, GVariant *props)
+{
+  GVariant   *v;
+  const char *str;
+  guchar      strength;
+  gboolean    favorite;
+  guint       old;
+  gboolean    changed = FALSE;
+
+  if (g_variant_lookup (props, "Name", "&s", &str))
+    changed |= service_set_name (table, s, str);
+
+  if (g_variant_lookup (props, "Type", "&s", &str))
+    {
+      old = s->wifi;
+      s->wifi = !strcmp (str, "wifi");
+      changed |= old != s->wifi;
+    }
+
+  if (g_variant_lookup (props, "State", "&s", &str))
+    {
+      old = s->state;
+      s->state = state_from_string (str);
+      changed |= old != s->state;
+    }
+
+  if (g_variant_lookup (props, "Strength", "y", &strength))
+    {
+      changed |= s->strength != strength;
+      s->strength = strength;
+    }
+
+  if (g_variant_lookup (props, "Favorite", "b", &favorite))
+    {
+      changed |= s->favorite != !!favorite;
+      s->favorite = favorite;
+    }
+
+  if ((v = g_variant_lookup_value (props, "Security",
+                                   G_VARIANT_TYPE_STRING_ARRAY)))
+    {
+      old = s->security;
+      s->security = security_from_variant (v);
+      changed |= old != s->security;
+      g_variant_unref (v);
+    }
+
+  return changed;
+}
+
+static ConnmanService *
+service_get (ConnmanServices *table, const char *path, gboolean *created)
+{
+  ConnmanService *s;
+
+  *created = FALSE;
+
+  if ((s = g_hash_table_lookup (table->by_path, path)))
+    return s;
+
+  s = g_slice_new0 (ConnmanService);
+  s->path = g_strdup (path);
+
+  g_ptr_array_add (table->services, s);
+  g_hash_table_insert (table->by_path, s->path, s);
+
+  *created = TRUE;
+
+  return s;
+}
+
+/*
+ * Applies the properties in the a{sv} dictionary to the service at path,
+ * adding the service if we do not have it yet; properties not in the
+ * dictionary are left as they are, so this works for both the full property
+ * sets and the changes connman sends.
+ */
+ConnmanService *
+connman_services_update (ConnmanServices *table,
+                         const char      *path,
+                         GVariant        *props)
+{
+  ConnmanService *s;
+  gboolean        created;
+
+  s = service_get (table, path, &created);
+  service_apply (table, s, props);
+
+  return s;
+}
+
+/*
+ * Returns whether there was such service.
+ */
+gboolean
+connman_services_remove (ConnmanServices *table, const char *path)
+{
+  ConnmanService *s;
+
+  if (!(s = g_hash_table_lookup (table->by_path, path)))
+    return FALSE;
+
+  if (s->name)
+    name_unindex (table, s);
+
+  g_hash_table_remove (table->by_path, path);
+  g_ptr_array_remove (table->services, s);
+
+  return TRUE;
+}
+
+void
+connman_services_clear (ConnmanServices *table)
+{
+  g_hash_table_remove_all (table->by_name);
+  g_hash_table_remove_all (table->by_path);
+  g_ptr_array_set_size (table->services, 0);
+}
+
+/*
+ * Applies a ServicesChanged signal: changed is the a(oa{sv}) list of all the
+ * services in the connman order, each with just the properties that changed,
+ * and removed the ao list of the services that went away. Returns whether the
+ * table changed in any way we care about.
+ */
+gboolean
+connman_services_apply (ConnmanServices *table,
+                        GVariant        *changed,
+                        GVariant        *removed)
+{
+  GPtrArray    *a = table->services;
+  GPtrArray    *order;
+  GVariantIter  iter;
+  const char   *path;
+  GVariant     *props;
+  gboolean      retval = FALSE;
+  guint         i;
+
+  g_variant_iter_init (&iter, removed);
+  while (g_variant_iter_next (&iter, "&o", &path))
+    retval |= connman_services_remove (table, path);
+
+  order = g_ptr_array_sized_new (g_variant_n_children (changed));
+
+  g_variant_iter_init (&iter, changed);
+  while (g_variant_iter_next (&iter, "(&o@a{sv})", &path, &props))
+    {
+      ConnmanService *s;
+      gboolean        created;
+
+      s = service_get (table, path, &created);
+      retval |= created;
+      retval |= service_apply (table, s, props);
+
+      /* connman should not list a service twice, but let's not trust it */
+      if (!s->listed)
+        {
+          s->listed = TRUE;
+          g_ptr_array_add (order, s);
+        }
+
+      g_variant_unref (props);
+    }
+
+  /* anything connman no longer lists goes at the end */
+  for (i = 0; i < a->len; i++)
+    {
+      ConnmanService *s = g_ptr_array_index (a, i);
+
+      if (!s->listed)
+        g_ptr_array_add (order, s);
+
+      s->listed = FALSE;
+    }
+
+  if (!retval)
+    retval = memcmp (a->pdata, order->pdata, a->len * sizeof (gpointer)) != 0;
+
+  memcpy (a->pdata, order->pdata, a->len * sizeof (gpointer));
+  g_ptr_array_free (order, TRUE);
+
+  return retval;
+}
+
+/*
+ * Replaces the contents of the table with the a(oa{sv}) list, as returned by
+ * GetServices.
+ */
+void
+connman_services_set_all (ConnmanServices *table, GVariant *list)
+{
+  GVariantIter  iter;
+  const char   *path;
+  GVariant     *props;
+
+  connman_services_clear (table);
+
+  g_variant_iter_init (&iter, list);
+  while (g_variant_iter_next (&iter, "(&o@a{sv})", &path, &props))
+    {
+      connman_services_update (table, path, props);
+      g_variant_unref (props);
+    }
+}
+
+const ConnmanService *
+connman_services_lookup (ConnmanServices *table, const char *path)
+{
+  return g_hash_table_lookup (table->by_path, path);
+}
+
+const ConnmanService *
+connman_services_lookup_name (ConnmanServices *table, const char *name)
+{
+  return g_hash_table_lookup (table->by_name, name);
+}
+
+/*
+ * Whether the service at index i is weaker than the one at j; for equal
+ * strength the one connman lists later is, which keeps the order stable.
+ */
+static inline gboolean
+weaker (GPtrArray *a, guint i, guint j)
+{
+  const ConnmanService *s = g_ptr_array_index (a, i);
+  const ConnmanService *t = g_ptr_array_index (a, j);
+
+  return s->strength < t->strength || (s->strength == t->strength && i > j);
+}
+
+static void
+heap_down (GPtrArray *a, guint *heap, guint len, guint k)
+{
+  for (;;)
+    {
+      guint c = 2 * k + 1;
+      guint m = k;
+      guint t;
+
+      if (c < len && weaker (a, heap[c], heap[m]))
+        m = c;
+
+      if (c + 1 < len && weaker (a, heap[c + 1], heap[m]))
+        m = c + 1;
+
+      if (m == k)
+        break;
+
+      t = heap[k];
+      heap[k] = heap[m];
+      heap[m] = t;
+      k = m;
+    }
+}
+
+/*
+ * Stores the n strongest wifi networks into top, strongest first, and returns
+ * how many there were. Hidden networks are skipped. This keeps a min-heap of
+ * the n best seen so far, so it is a single pass over the table.
+ */
+guint
+connman_services_top (ConnmanServices       *table,
+                      guint                  n,
+                      const ConnmanService **top)
+{
+  GPtrArray *a = table->services;
+  guint     *heap;
+  guint      len = 0;
+  guint      count;
+  guint      i;
+
+  if (!n || !a->len)
+    return 0;
+
+  heap = g_new (guint, MIN (n, a->len));
+
+  for (i = 0; i < a->len; i++)
+    {
+      const ConnmanService *s = g_ptr_array_index (a, i);
+
+      if (!s->wifi || !s->name)
+        continue;
+
+      if (len < n)
+        {
+          guint k = len++;
+
+          heap[k] = i;
+
+          while (k && weaker (a, heap[k], heap[(k - 1) / 2]))
+            {
+              guint p = (k - 1) / 2;
+              guint t = heap[k];
+
+              heap[k] = heap[p];
+              heap[p] = t;
+              k = p;
+            }
+        }
+      else if (weaker (a, heap[0], i))
+        {
+          heap[0] = i;
+          heap_down (a, heap, len, 0);
+        }
+    }
+
+  /* the weakest is on the top of the heap, it goes last */
+  count = len;
+
+  while (len)
+    {
+      top[--len] = g_ptr_array_index (a, heap[0]);
+      heap[0] = heap[len];
+      heap_down (a, heap, len, 0);
+    }
+
+  g_free (heap);
+
+  return count;
+}
+
+const char *
+connman_service_state_name (ServiceState state)
+{
+  if (state >= G_N_ELEMENTS (state_names))
+    return NULL;
+
+  return state_names[state];
+}
+
+const char *
+connman_service_security_name (guint flag)
+{
+  gint bit = g_bit_nth_lsf (flag, -1);
+
+  if (bit < 0 || bit >= (gint) G_N_ELEMENTS (security_names))
+    return NULL;
+
+  return security_names[bit];
+}
+
+/*
+ * The security as shown in the network list, e.g., "[wep, psk]", or an empty
+ * string for open networks. There are only a few combinations, so each one
+ * is made the first time it is needed and kept.
+ */
+const char *
+connman_service_security_text (guint security)
+{
+  static char *texts[SERVICE_SECURITY_MASK + 1];
+
+  security &= SERVICE_SECURITY_MASK & ~SERVICE_SECURITY_NONE;
+
+  if (!texts[security])
+    {
+      GString *s = g_string_new (NULL);
+      guint    i;
+
+      for (i = 0; i < G_N_ELEMENTS (security_names); i++)
+        if (security & (1 << i))
+          {
+            g_string_append (s, s->len ? ", " : "[");
+            g_string_append (s, security_names[i]);
+          }
+
+      if (s->len)
+        g_string_append_c (s, ']');
+
+      texts[security] = g_string_free (s, FALSE);
+    }
+
+  return texts[security];
+}
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_CONNMAN_SERVICES_H
+#define GUACA_CONNMAN_SERVICES_H
+
+#include <glib.h>
+
+typedef enum
+{
+  SERVICE_STATE_UNKNOWN = 0,
+  SERVICE_STATE_IDLE,
+  SERVICE_STATE_FAILURE,
+  SERVICE_STATE_ASSOCIATION,
+  SERVICE_STATE_CONFIGURATION,
+  SERVICE_STATE_READY,
+  SERVICE_STATE_DISCONNECT,
+  SERVICE_STATE_ONLINE,
+} ServiceState;
+
+enum
+{
+  SERVICE_SECURITY_NONE      = 0x01,
+  SERVICE_SECURITY_WEP       = 0x02,
+  SERVICE_SECURITY_PSK       = 0x04,
+  SERVICE_SECURITY_IEEE8021X = 0x08,
+  SERVICE_SECURITY_WPS       = 0x10,
+
+  SERVICE_SECURITY_MASK      = 0x1f,
+};
+
+/*
+ * A single connman service, holding just the properties we show. The name is
+ * NULL for hidden networks.
+ */
+typedef struct
+{
+  char       *name;
+  char       *path;
+  guint8      state;     /* ServiceState */
+  guint8      security;  /* SERVICE_SECURITY_ flags */
+  guint8      strength;
+  guint       wifi     : 1;
+  guint       favorite : 1;
+
+  /* < private > */
+  guint       listed   : 1;
+} ConnmanService;
+
+#define SERVICE_IS_CONNECTED(s) ((s)->state == SERVICE_STATE_READY || \
+                                 (s)->state == SERVICE_STATE_ONLINE)
+
+/*
+ * The services in the order connman lists them, i.e., its preference, indexed
+ * by the object path and by the name (ssid); for duplicate names the name
+ * index holds one of them.
+ */
+typedef struct
+{
+  GPtrArray  *services;
+
+  /* < private > */
+  GHashTable *by_path;
+  GHashTable *by_name;
+} ConnmanServices;
+
+ConnmanServices      *connman_services_new         (void);
+void                  connman_services_free        (ConnmanServices *table);
+void                  connman_services_set_all     (ConnmanServices *table,
+                                                    GVariant        *list);
+ConnmanService       *connman_services_update      (ConnmanServices *table,
+                                                    const char      *path,
+                                                    GVariant        *props);
+gboolean              connman_services_remove      (ConnmanServices *table,
+                                                    const char      *path);
+void                  connman_services_clear       (ConnmanServices *table);
+gboolean              connman_services_apply       (ConnmanServices *table,
+                                                    GVariant        *changed,
+                                                    GVariant        *removed);
+const ConnmanService *connman_services_lookup      (ConnmanServices *table,
+                                                    const char      *path);
+const ConnmanService *connman_services_lookup_name (ConnmanServices *table,
+                                                    const char      *name);
+guint                 connman_services_top         (ConnmanServices *table,
+                                                    guint            n,
+                                                    const ConnmanService **top);
+
+const char           *connman_service_state_name    (ServiceState state);
+const char           *connman_service_security_name (guint flag);
+const char           *connman_service_security_text (guint security);
+
+#endif
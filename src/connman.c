@@ -28,15 +28,17 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
-#include <readline/readline.h>
 
 #include "main.h"
 #include "connman.h"
-#include "connman-agent-introspection.h"
+#include "command.h"
+#include "json.h"
+#include "connman-agent-info.h"
 #include "mtn-connman.h"
 #include "mtn-connman-service.h"
 
 #define PROMPT "wifi> "
+#define AGENT_PATH "/org/GuacamayoProject/ConnmanAgent"
 /*
  * Most of this comes directly from the MEX networks plugin, including the
  * auxiliary mtn source files.
@@ -52,74 +54,125 @@ typedef enum
   MTN_CONNMAN_FIELD_PASSWORD_MASK = 0x11110000,
 }MtnConnmanFields;
 
+/*
+ * The session with connman, i.e., the proxy and our registered agent, is set
+ * up by the first wifi command and kept until we exit, so the later ones
+ * start without any round trips.
+ */
+typedef enum
+{
+  SESSION_NONE = 0,
+  SESSION_STARTING,
+  SESSION_READY,
+} SessionState;
+
 typedef struct
 {
-  GMainLoop         *loop;
-  guint              name_id;
-  guint              object_id;
+  SessionState      state;
+  guint             serial;
+  guint             pending;   /* the parallel setup steps still to finish */
 
-  MtnConnman        *connman;
-  MtnConnmanService *service;
+  guint             name_id;
+  guint             object_id;
+  guint             lost_id;
+
+  MtnConnman       *connman;
+  GDBusConnection  *connection;
+
+  /* the proxy failed to get the service list, and we asked again */
+  gboolean          services_pending;
+
+  guint             agent_registered : 1;
+} ConnmanSession;
+
+/*
+ * The state of a single wifi command. The D-Bus calls made on its behalf hold
+ * a reference, and are cancelled when the command finishes; their callbacks
+ * only free the reference then.
+ */
+typedef struct
+{
+  guint                  ref_count;
+  GCancellable          *cancellable;
+
+  MtnConnmanService     *service;
 
-  /* Agent stuff */
-  GDBusConnection       *connection;
-  GDBusNodeInfo         *agent_gir;
   MtnConnmanFields       agent_field_mask;
   GDBusMethodInvocation *agent_input_invocation;
 
-  GHashTable            *services;
+  char                  *agent_name;
+
+  /* the path of the service to connect to once the agent is registered */
+  const char            *connect_key;
+
+  /* the networks listed; kept up to date on the screen while we wait */
+  ConnmanList           *list;
+  MtnConnman            *live;
+  guint                  limit;
+
+  /* set once the command is done, never reset */
+  guint                  finish_id;
 
-  guint agent_submitted  : 1;
-  guint agent_registered : 1;
   guint cancelled        : 1;
+  guint success          : 1;
 } ConnmanData;
 
-static void connection_requested (ConnmanData *d, const char *name);
+static void connection_requested (ConnmanData *d, const char *path);
+static void wifi_done (ConnmanData *d, gboolean success);
 
-static ConnmanData data = {0,};
+static ConnmanSession  session = {0,};
 
-static gboolean
-submit_passphrase (ConnmanData *d)
+/* the wifi command in progress, the agent requests are made on its behalf */
+static ConnmanData    *current = NULL;
+
+static ConnmanData *
+connman_data_ref (ConnmanData *d)
+{
+  d->ref_count++;
+  return d;
+}
+
+static void
+connman_data_unref (ConnmanData *d)
+{
+  if (--d->ref_count)
+    return;
+
+  if (d->service)
+    g_object_unref (d->service);
+
+  connman_list_free (d->list);
+  g_object_unref (d->cancellable);
+  g_free (d->agent_name);
+
+  g_slice_free (ConnmanData, d);
+}
+
+static void
+cancel_input (ConnmanData *d, const char *msg)
+{
+  GDBusMethodInvocation *invocation = d->agent_input_invocation;
+
+  d->agent_input_invocation = NULL;
+  d->cancelled = TRUE;
+
+  g_dbus_method_invocation_return_dbus_error (invocation,
+                                              "net.connman.Agent.Error.Canceled",
+                                              msg);
+  g_object_unref (invocation);
+}
+
+static void
+submit_input (ConnmanData *d, const char *pass)
 {
   GVariant              *input;
   GVariant              *tup;
   GVariantBuilder        builder;
-  const char            *pass;
-  const char            *name;
+  const char            *name = d->agent_name;
   GDBusMethodInvocation *invocation = d->agent_input_invocation;
 
-  if (!invocation)
-    {
-      g_warning ("Can't submit passpharse without invocation object!");
-      return FALSE;
-    }
-
   d->agent_input_invocation = NULL;
 
-  if (d->agent_field_mask & MTN_CONNMAN_FIELD_USERNAME_MASK)
-    if (!(name = readline (PROMPT "Enter username: ")) || !*name)
-      {
-        output (PROMPT "User name is required!\n");
-        d->cancelled = TRUE;
-        g_dbus_method_invocation_return_dbus_error (invocation,
-                                           "net.connman.Agent.Error.Canceled",
-                                           "No username");
-        g_object_unref (invocation);
-        return FALSE;
-      }
-
-  if (d->agent_field_mask & MTN_CONNMAN_FIELD_PASSWORD_MASK)
-    if (!(pass = readline (PROMPT "Enter passphrase: ")) || !*pass)
-      {
-        output (PROMPT "Passphrase is required!\n");
-        d->cancelled = TRUE;
-        g_dbus_method_invocation_return_dbus_error (invocation,
-                                           "net.connman.Agent.Error.Canceled",
-                                           "No passphrase");
-        g_object_unref (invocation);
-        return FALSE;
-      }
-
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a{sv})"));
   g_variant_builder_open (&builder , G_VARIANT_TYPE ("a{sv}"));
 
@@ -150,7 +203,60 @@ submit_passphrase (ConnmanData *d)
   g_dbus_method_invocation_return_value (invocation, tup);
   g_object_unref (invocation);
 
-  return TRUE;
+  g_free (d->agent_name);
+  d->agent_name = NULL;
+}
+
+static void
+passphrase_cb (const char *pass, gpointer data)
+{
+  ConnmanData *d = data;
+
+  if (!pass || !*pass)
+    {
+      output (PROMPT "Passphrase is required!\n");
+      cancel_input (d, "No passphrase");
+      wifi_done (d, FALSE);
+      return;
+    }
+
+  submit_input (d, pass);
+}
+
+static void
+username_cb (const char *name, gpointer data)
+{
+  ConnmanData *d = data;
+
+  if (!name || !*name)
+    {
+      output (PROMPT "User name is required!\n");
+      cancel_input (d, "No username");
+      wifi_done (d, FALSE);
+      return;
+    }
+
+  d->agent_name = g_strdup (name);
+
+  if (d->agent_field_mask & MTN_CONNMAN_FIELD_PASSWORD_MASK)
+    request_input (PROMPT "Enter passphrase: ", passphrase_cb, d);
+  else
+    submit_input (d, NULL);
+}
+
+/*
+ * Asks for the credentials connman requested; the reply is sent once the user
+ * has entered them.
+ */
+static void
+request_credentials (ConnmanData *d)
+{
+  if (d->agent_field_mask & MTN_CONNMAN_FIELD_USERNAME_MASK)
+    request_input (PROMPT "Enter username: ", username_cb, d);
+  else if (d->agent_field_mask & MTN_CONNMAN_FIELD_PASSWORD_MASK)
+    request_input (PROMPT "Enter passphrase: ", passphrase_cb, d);
+  else
+    submit_input (d, NULL);
 }
 
 static void
@@ -161,8 +267,10 @@ agent_method_cb (GDBusConnection       *connection,
                  const gchar           *method_name,
                  GVariant              *parameters,
                  GDBusMethodInvocation *invocation,
-                 ConnmanData           *d)
+                 gpointer               data)
 {
+  ConnmanData *d = current;
+
   if (g_strcmp0 (method_name, "ReportError") == 0)
    {
      const char *object;
@@ -207,19 +315,30 @@ agent_method_cb (GDBusConnection       *connection,
 
        }
 
-     d->agent_field_mask = mask;
      g_variant_iter_free (fields);
 
+     /* the agent stays registered between the wifi commands */
+     if (!d)
+       {
+         g_dbus_method_invocation_return_dbus_error (invocation,
+                                           "net.connman.Agent.Error.Canceled",
+                                           "No connection in progress");
+         return;
+       }
+
      if (d->agent_input_invocation)
        {
          output (PROMPT "Warning: RequestInput already in progress!\n");
-         g_object_unref (d->agent_input_invocation);
+         g_dbus_method_invocation_return_dbus_error (invocation,
+                                           "net.connman.Agent.Error.Canceled",
+                                           "Input already in progress");
+         return;
        }
 
+     d->agent_field_mask = mask;
      d->agent_input_invocation = g_object_ref (invocation);
 
-     if (!submit_passphrase (d))
-       g_main_loop_quit (d->loop);
+     request_credentials (d);
    }
  else
    {
@@ -235,173 +354,423 @@ static const GDBusInterfaceVTable agent_interface_table =
   NULL
 };
 
+/*
+ * The network list as shown; it can be updated in place as connman reports
+ * changes. The rows stay in the order they were listed, as the user picks the
+ * network by its number; networks that appear later are not added.
+ */
+struct _ConnmanList
+{
+  guint        n;
+  char       **paths;
+  char       **names;  /* copied, so valid after the service is gone */
+  char       **lines;  /* as last drawn, without the newline */
+  int          width;
+};
+
+/*
+ * The names are padded to the same number of characters, not bytes, so that
+ * the columns line up, and the updates land where they should.
+ */
+static char *
+list_line (ConnmanList *list, guint i, const ConnmanService *s)
+{
+  const char *name = list->names[i];
+  int         pad = list->width - g_utf8_strlen (name, -1);
+
+  if (!s)
+    return g_strdup_printf (PROMPT "    %d:  %s%*s (gone)", i + 1,
+                            name, pad, "");
+
+  return g_strdup_printf (PROMPT "    %d: %s%s%*s %3d%% %s", i + 1,
+                          SERVICE_IS_CONNECTED (s) ? "*" : " ",
+                          name, pad, "", s->strength,
+                          connman_service_security_text (s->security));
+}
+
+ConnmanList *
+connman_list_new (const ConnmanService **services, guint n)
+{
+  ConnmanList *list = g_slice_new0 (ConnmanList);
+  guint        i;
+
+  list->n     = n;
+  list->paths = g_new0 (char *, n + 1);
+  list->names = g_new0 (char *, n + 1);
+  list->lines = g_new0 (char *, n + 1);
+
+  for (i = 0; i < n; i++)
+    list->width = MAX (list->width, g_utf8_strlen (services[i]->name, -1));
+
+  for (i = 0; i < n; i++)
+    {
+      list->paths[i] = g_strdup (services[i]->path);
+      list->names[i] = g_strdup (services[i]->name);
+      list->lines[i] = list_line (list, i, services[i]);
+    }
+
+  return list;
+}
+
+void
+connman_list_free (ConnmanList *list)
+{
+  if (!list)
+    return;
+
+  g_strfreev (list->paths);
+  g_strfreev (list->lines);
+  g_strfreev (list->names);
+
+  g_slice_free (ConnmanList, list);
+}
+
+/*
+ * Lists the services, numbered from 1, marking the connected one and showing
+ * the strength and security.
+ */
+void
+connman_list_print (ConnmanList *list)
+{
+  guint i;
+
+  for (i = 0; i < list->n; i++)
+    output ("%s\n", list->lines[i]);
+}
+
+/*
+ * Redraws the rows that changed since they were drawn; below is the number of
+ * lines printed after the list, the cursor being on the line after those.
+ * Rows scrolled off the screen are left be. Returns the number of rows
+ * redrawn.
+ */
+guint
+connman_list_update (ConnmanList *list, ConnmanServices *table, guint below)
+{
+  guint i, n = 0;
+
+  for (i = 0; i < list->n; i++)
+    {
+      const ConnmanService *s;
+      char                 *line;
+
+      s    = connman_services_lookup (table, list->paths[i]);
+      line = list_line (list, i, s);
+
+      if (strcmp (line, list->lines[i]) &&
+          output_update_line (list->n - i + below, list->lines[i], line))
+        n++;
+
+      g_free (list->lines[i]);
+      list->lines[i] = line;
+    }
+
+  return n;
+}
+
+/*
+ * The JSON counterpart of connman_list_print().
+ */
 static void
-register_agent_cb (GObject *object, GAsyncResult *res, gpointer data)
+json_services (const ConnmanService **services, guint n)
+{
+  guint i, flag;
+
+  json_begin_array ("services");
+
+  for (i = 0; i < n; i++)
+    {
+      const ConnmanService *s = services[i];
+
+      json_begin_object (NULL);
+      json_string ("name", s->name);
+      json_string ("path", s->path);
+
+      if (s->state != SERVICE_STATE_UNKNOWN)
+        json_string ("state", connman_service_state_name (s->state));
+
+      json_int ("strength", s->strength);
+
+      json_begin_array ("security");
+
+      for (flag = 1; flag <= SERVICE_SECURITY_MASK; flag <<= 1)
+        if (s->security & flag)
+          json_string (NULL, connman_service_security_name (flag));
+
+      json_end_array ();
+      json_end_object ();
+    }
+
+  json_end_array ();
+}
+
+/* the blank line and the "Select" line between the list and the prompt */
+#define LIST_LINES_BELOW 2
+
+static void
+list_changed_cb (MtnConnman *connman, GVariant *value, gpointer data)
+{
+  ConnmanData     *d = data;
+  ConnmanServices *services;
+
+  if ((services = mtn_connman_get_services (connman)))
+    connman_list_update (d->list, services, LIST_LINES_BELOW);
+}
+
+static void
+stop_live_list (ConnmanData *d)
+{
+  if (!d->live)
+    return;
+
+  g_signal_handlers_disconnect_by_func (d->live, list_changed_cb, d);
+  g_object_unref (d->live);
+  d->live = NULL;
+}
+
+static void
+select_wifi_cb (const char *sel, gpointer data)
 {
   ConnmanData *d = data;
-  GError      *error = NULL;
-  GVariant    *var;
+  int          i;
+
+  /* anything printed from now on would throw the row positions off */
+  stop_live_list (d);
+
+  if (!sel || (i = strtol (sel, NULL, 10)) < 1)
+    {
+      wifi_done (d, TRUE);
+      return;
+    }
+
+  if (i > (int) d->list->n)
+    {
+      wifi_done (d, FALSE);
+      return;
+    }
+
+  connection_requested (d, d->list->paths[i-1]);
+}
+
+/*
+ * Lists the wifi services of the session, strongest first, and asks which one
+ * to connect to.
+ */
+static void
+show_services (ConnmanData *d)
+{
+  ConnmanServices       *services = mtn_connman_get_services (session.connman);
+  const ConnmanService **top;
+  guint                  n;
+
+  n = services->services->len;
+
+  if (d->limit)
+    n = MIN (n, d->limit);
+
+  top = g_new (const ConnmanService *, MAX (n, 1));
+  n = connman_services_top (services, n, top);
+
+  /* no selection in JSON mode, the list is the result */
+  if (json_is_enabled ())
+    {
+      json_services (top, n);
+      g_free (top);
 
-  if ((var = g_dbus_proxy_call_finish (G_DBUS_PROXY (object), res, &error)))
-    g_variant_unref (var);
+      wifi_done (d, TRUE);
+      return;
+    }
+
+  d->list = connman_list_new (top, n);
+  g_free (top);
+
+  output (PROMPT "Available networks:\n" PROMPT "\n");
+
+  connman_list_print (d->list);
+
+  output (PROMPT "\n" PROMPT "Select wifi [1-%d]:\n", n);
+
+  /* on a terminal the list follows what connman reports */
+  if (output_has_cursor_addressing ())
+    {
+      d->live = g_object_ref (session.connman);
+      g_signal_connect (d->live, "services-changed",
+                        G_CALLBACK (list_changed_cb), d);
+    }
+
+  request_input (PROMPT "? ", select_wifi_cb, d);
+}
+
+static void
+get_services_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+  GError *error = NULL;
+
+  mtn_connman_list_services_finish (MTN_CONNMAN (object), res, &error);
+
+  /* a reply from a session since dropped */
+  if (object != (GObject *) session.connman)
+    {
+      g_clear_error (&error);
+      return;
+    }
+
+  session.services_pending = FALSE;
+
+  /* the command might have been cancelled in the meantime */
+  if (!current || current->finish_id)
+    {
+      g_clear_error (&error);
+      return;
+    }
 
   if (error)
     {
-      output (PROMPT "error: %s.", error->message);
+      output (PROMPT "Failed to list services: %s\n", error->message);
       g_error_free (error);
-      g_main_loop_quit (d->loop);
+      wifi_done (current, FALSE);
       return;
     }
 
-  output ("done.\n");
-  d->agent_registered = TRUE;
+  show_services (current);
+}
 
-  if ((var = mtn_connman_get_services (d->connman)))
+/*
+ * The proxy keeps its service list current from the changes connman reports,
+ * so it is only fetched here if the proxy failed to get it in the first place.
+ */
+static void
+list_services (ConnmanData *d)
+{
+  if (mtn_connman_get_services (session.connman))
     {
-      GVariantIter *iter, *serv;
-      char         *opath;
+      show_services (d);
+      return;
+    }
 
-      g_variant_get (var, "(a(oa{sv}))", &iter);
-      while (g_variant_iter_next (iter, "(oa{sv})", &opath, &serv))
-        {
-          char       *key;
-          GVariant   *value;
-          GHashTable *props;
-          gboolean    is_wifi = FALSE;
-          const char *name = NULL;
-
-          props = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                         g_free,
-                                         (GDestroyNotify)g_variant_unref);
-
-          while (g_variant_iter_next (serv, "{sv}", &key, &value))
-            {
-              g_hash_table_insert (props, key, value);
-
-              if (!g_strcmp0 (key, "Type") &&
-                  !g_strcmp0 ("wifi", g_variant_get_string (value, NULL)))
-                is_wifi = TRUE;
-
-              if (!g_strcmp0 (key, "Name"))
-                name = g_variant_get_string (value, NULL);
-            }
-
-          if (!is_wifi || !name)
-            g_hash_table_destroy (props);
-          else
-            {
-              g_hash_table_insert (props, g_strdup ("DbusPath"), opath);
-              g_hash_table_insert (d->services, (gpointer)name, props);
-            }
-
-          g_variant_iter_free (serv);
-        }
+  /* a cancelled command left the call going, the reply goes to this one */
+  if (session.services_pending)
+    return;
+
+  session.services_pending = TRUE;
+
+  mtn_connman_list_services (session.connman, get_services_cb, NULL);
+}
+
+/*
+ * Drops the session; the next wifi command sets up a new one.
+ */
+static void
+session_reset (void)
+{
+  if (session.lost_id)
+    g_source_remove (session.lost_id);
 
-      g_variant_iter_free (iter);
+  if (session.connman)
+    {
+      g_signal_handlers_disconnect_by_data (session.connman, &session);
+      g_object_unref (session.connman);
     }
 
-  if (d->services)
+  if (session.connection)
     {
-      int         i;
-      GList      *keys, *l;
-      char       *sel;
-      const char *key;
-      gboolean    quit = FALSE;
-      int         max_len = 0;
-      char       *fmt;
+      if (session.object_id)
+        g_dbus_connection_unregister_object (session.connection,
+                                             session.object_id);
 
-      output (PROMPT "Available networks:\n" PROMPT "\n");
+      g_object_unref (session.connection);
+    }
 
-      keys = g_hash_table_get_keys (d->services);
+  if (session.name_id)
+    g_bus_unown_name (session.name_id);
 
-      for (i = 0, l = keys; l; l = l->next, i++)
-        {
-          const char *k = l->data;
+  memset (&session, 0, sizeof (session));
+}
 
-          max_len = MAX (max_len, strlen (k));
-        }
+/*
+ * Setting up the session failed, the command waiting for it fails too.
+ */
+static void
+session_failed (void)
+{
+  session_reset ();
 
-      fmt = g_strdup_printf (PROMPT "    %%d: %%s%%-%ds %%s\n", max_len);
+  if (current)
+    wifi_done (current, FALSE);
+}
 
-      for (i = 0, l = keys; l; l = l->next, i++)
-        {
-          /* construct a line reflecting status and security of the service */
-          const char *k     = l->data;
-          GHashTable *p     = g_hash_table_lookup (d->services, k);
-          GVariant   *v     = g_hash_table_lookup (p, "State");
-          const char *state = " ";
-          char       *sec   = NULL;
-
-          if (v)
-            {
-              const char *st = g_variant_get_string (v, NULL);
-
-              if (!g_strcmp0 (st, "ready") || !g_strcmp0 (st, "online"))
-                state = "*";
-            }
-
-          if ((v = g_hash_table_lookup (p, "Security")))
-            {
-              GVariantIter *it;
-              char         *s;
-
-              g_variant_get (v, "as", &it);
-              while (g_variant_iter_next (it, "s", &s))
-                {
-                  if (!g_strcmp0 (s, "none"))
-                    ;
-                  else if (sec)
-                    {
-                      char *t = g_strconcat (sec, ", ", s, NULL);
-
-                      g_free (sec);
-                      sec = t;
-                    }
-                  else
-                    sec = g_strconcat ("[", s, NULL);
-
-                  g_free (s);
-                }
-
-              g_variant_iter_free (it);
-            }
-
-          if (!sec)
-            sec = g_strdup ("");
-          else
-            {
-              char *t = g_strconcat (sec, "]", NULL);
-              g_free (sec);
-              sec = t;
-            }
-
-          output (fmt, i+1, state, k, sec);
-          g_free (sec);
-        }
+static gboolean
+session_lost_cb (gpointer data)
+{
+  session.lost_id = 0;
 
-      g_free (fmt);
+  output (PROMPT "Lost connection to connman.\n");
+  session_failed ();
 
-      output (PROMPT "\n" PROMPT "Select wifi [1-%d]:\n", i);
+  return FALSE;
+}
 
-      if ((sel = readline (PROMPT "? ")))
-        {
-          if ((i = strtol (sel, NULL, 10)) < 1)
-            quit = TRUE;
-          else
-            {
-              key = g_list_nth_data (keys, i-1);
-              connection_requested (d, key);
-            }
-        }
-      else
-        quit = TRUE;
+/*
+ * If connman goes away or restarts, it forgets our agent; the session is
+ * dropped from an idle callback, since we are inside a signal of the proxy.
+ */
+static void
+name_owner_cb (GObject *object, GParamSpec *pspec, gpointer data)
+{
+  if (!session.lost_id)
+    session.lost_id = g_idle_add (session_lost_cb, NULL);
+}
 
-      g_list_free (keys);
-      free (sel);
+/*
+ * The session is set up in parallel: the bus connection for the agent, and
+ * the connman proxy, which comes with the service list, are requested at the
+ * same time. The services are listed as soon as the proxy is ready; the agent
+ * is registered once both are there, and only connecting has to wait for it.
+ *
+ * The callbacks are passed the serial of the session they were started for,
+ * so the results of a session dropped in the meantime can be discarded.
+ */
+#define SESSION_SERIAL(data) (GPOINTER_TO_UINT (data))
 
-      if (quit)
-        g_main_loop_quit (d->loop);
+static void
+register_agent_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+  GError *error = NULL;
+
+  mtn_connman_register_agent_finish (MTN_CONNMAN (object), res, &error);
+
+  if (SESSION_SERIAL (data) != session.serial)
+    {
+      g_clear_error (&error);
+      return;
     }
+
+  if (error)
+    {
+      output (PROMPT "Failed to register agent: %s\n", error->message);
+      g_error_free (error);
+      session_failed ();
+      return;
+    }
+
+  session.agent_registered = TRUE;
+
+  if (current && current->connect_key)
+    connection_requested (current, current->connect_key);
+}
+
+/*
+ * Called as each of the parallel steps completes; the agent is registered
+ * once they all have.
+ */
+static void
+session_join (void)
+{
+  if (--session.pending)
+    return;
+
+  mtn_connman_register_agent (session.connman, AGENT_PATH, register_agent_cb,
+                              GUINT_TO_POINTER (session.serial));
 }
 
 static void
@@ -409,96 +778,85 @@ agent_bus_acquired (GObject      *source_object,
                     GAsyncResult *result,
                     gpointer      data)
 {
-  ConnmanData *d = data;
-  GError      *error = NULL;
+  GError          *error = NULL;
+  GDBusConnection *connection;
+
+  connection = g_bus_get_finish (result, &error);
+
+  if (SESSION_SERIAL (data) != session.serial)
+    {
+      if (connection)
+        g_object_unref (connection);
 
-  d->connection = g_bus_get_finish (result, &error);
+      g_clear_error (&error);
+      return;
+    }
 
   if (error)
     {
-      output (PROMPT "error: %s\n", error->message);
+      output (PROMPT "DBus: %s\n", error->message);
       g_error_free (error);
-      g_main_loop_quit (d->loop);
+      session_failed ();
       return;
     }
-  else
-    output ("done.\nwifi> Registering agent ... ");
 
-  d->object_id =
-    g_dbus_connection_register_object (d->connection,
-                                       "/org/GuacamayoProject/ConnmanAgent",
-                                       d->agent_gir->interfaces[0],
+  session.connection = connection;
+  session.object_id =
+    g_dbus_connection_register_object (session.connection,
+                                       AGENT_PATH,
+                                       (GDBusInterfaceInfo *)
+                                       &connman_agent_interface,
                                        &agent_interface_table,
-                                       d,
+                                       &session,
                                        NULL,
                                        &error);
 
   if (error)
     {
-      output ("failed: %s\n", error->message);
+      output (PROMPT "Failed to register agent: %s\n", error->message);
       g_error_free (error);
-      g_main_loop_quit (d->loop);
+      session_failed ();
+      return;
     }
-  else if (d->connman && !d->agent_submitted)
-    {
-      GVariant *o =
-        g_variant_new ("(o)", "/org/GuacamayoProject/ConnmanAgent");
 
-      g_dbus_proxy_call (G_DBUS_PROXY (d->connman), "RegisterAgent", o,
-                         G_DBUS_CALL_FLAGS_NONE, 120000, NULL,
-                         register_agent_cb, d);
-      d->agent_submitted = TRUE;
-    }
+  session_join ();
 }
 
 static void
-register_agent (ConnmanData *d)
+connman_new_cb (GObject *object, GAsyncResult *res, gpointer data)
 {
-  GError *error = NULL;
+  GError      *error = NULL;
+  MtnConnman  *connman;
 
-  d->name_id = g_bus_own_name (G_BUS_TYPE_SYSTEM,
-                               "org.guacamayo-project.ConnmanAgent",
-                               G_BUS_NAME_OWNER_FLAGS_NONE,
-                               NULL,
-                               NULL,
-                               NULL,
-                               NULL,
-                               NULL);
+  connman = mtn_connman_new_finish (res, &error);
 
-  if (!(d->agent_gir =
-        g_dbus_node_info_new_for_xml (connman_agent_introspection, &error)))
+  if (SESSION_SERIAL (data) != session.serial)
     {
-      g_warning ("Error %s", error->message);
+      if (connman)
+        g_object_unref (connman);
+
       g_clear_error (&error);
-      g_main_loop_quit (d->loop);
       return;
     }
 
-  output (PROMPT "Connecting to DBus ... ");
-  g_bus_get (G_BUS_TYPE_SYSTEM, NULL, agent_bus_acquired, d);
-}
-
-static void
-connman_new_cb (GObject *object, GAsyncResult *res, gpointer data)
-{
-  ConnmanData *d = data;
-  GError      *error = NULL;
-  GVariant    *var;
-
-  d->connman = mtn_connman_new_finish (res, &error);
-  if (!d->connman)
+  if (!connman)
     {
       output (PROMPT "Connman proxy: %s\n", error->message);
       g_error_free (error);
-      g_main_loop_quit (d->loop);
+      session_failed ();
       return;
     }
 
-  /*
-   * Only initiate this here, so we do not get output messages mixed up
-   * on the console due to the async nature.
-   */
-  register_agent (d);
+  session.connman = connman;
+  session.state   = SESSION_READY;
+
+  g_signal_connect (session.connman, "notify::g-name-owner",
+                    G_CALLBACK (name_owner_cb), &session);
+
+  if (current)
+    list_services (current);
+
+  session_join ();
 }
 
 static void
@@ -512,24 +870,26 @@ service_state_changed_cb (MtnConnmanService *service,
 
   val = g_variant_get_string (state, NULL);
 
+  /* association and configuration are on the way, we wait for the outcome */
   if (!g_strcmp0 (val, "online"))
     {
       output (PROMPT "Online.\n");
+      wifi_done (d, TRUE);
     }
   else if (!g_strcmp0 (val, "ready"))
     {
       output (PROMPT "Connected.\n");
+      wifi_done (d, TRUE);
     }
   else if (!g_strcmp0 (val, "failure"))
     {
       output (PROMPT "Connection failed.\n");
+      wifi_done (d, FALSE);
     }
   else if (!g_strcmp0 (val, "disconnect"))
     {
       output (PROMPT "Disconnected\n");
     }
-
-  g_main_loop_quit (d->loop);
 }
 
 static gboolean
@@ -556,19 +916,25 @@ static void
 connect_cb (GObject *object, GAsyncResult *res, gpointer data)
 {
   ConnmanData *d = data;
-  GVariant    *var;
   GError      *error = NULL;
-  gboolean     quit = FALSE;
 
-  if ((var = g_dbus_proxy_call_finish (G_DBUS_PROXY (object), res, &error)))
-    g_variant_unref (var);
+  mtn_connman_service_connect_finish (MTN_CONNMAN_SERVICE (object), res,
+                                      &error);
+
+  /* the command is over, including when we cancelled the call */
+  if (d->finish_id)
+    {
+      g_clear_error (&error);
+      connman_data_unref (d);
+      return;
+    }
 
   if (error)
     {
       if (is_connman_error (error, "AlreadyConnected"))
         {
           output (PROMPT "Already connected.\n");
-          quit = TRUE;
+          wifi_done (d, TRUE);
         }
       else if (is_connman_error (error, "InProgress"))
         {
@@ -578,63 +944,88 @@ connect_cb (GObject *object, GAsyncResult *res, gpointer data)
         {
           if (!d->cancelled)
             output (PROMPT "Connection failed: %s.\n", error->message);
+
+          wifi_done (d, FALSE);
         }
       else
         {
           output (PROMPT "Connection failed: %s.\n", error->message);
+          wifi_done (d, FALSE);
         }
 
       g_error_free (error);
     }
 
-  if (quit)
-    g_main_loop_quit (d->loop);
+  connman_data_unref (d);
 }
 
 static void
 connman_service_new_cb (GObject *object, GAsyncResult *res, gpointer data)
 {
-  ConnmanData *d = data;
-  GError      *error = NULL;
+  ConnmanData       *d = data;
+  MtnConnmanService *service;
+  GError            *error = NULL;
 
-  if (!(d->service = mtn_connman_service_new_finish (res, &error)))
+  service = mtn_connman_service_new_finish (res, &error);
+
+  if (d->finish_id)
+    {
+      if (service)
+        g_object_unref (service);
+
+      g_clear_error (&error);
+      connman_data_unref (d);
+      return;
+    }
+
+  if (!service)
     {
       output (PROMPT "Failed to connect: %s\n", error->message);
       g_error_free (error);
-
+      wifi_done (d, FALSE);
+      connman_data_unref (d);
       return;
     }
 
+  d->service = service;
+
   g_signal_connect (d->service, "property-changed::State",
                     G_CALLBACK (service_state_changed_cb),
                     d);
 
-  g_dbus_proxy_call (G_DBUS_PROXY (d->service), "Connect", NULL,
-                     G_DBUS_CALL_FLAGS_NONE, 120000, NULL,
-                     connect_cb, d);
+  /* the reply comes once connected, which can take a while; the reference
+   * passes on to the call */
+  mtn_connman_service_connect (d->service, 120000, d->cancellable,
+                               connect_cb, d);
 
   output (PROMPT "Connecting ... \n");
 }
 
 static void
-connection_requested (ConnmanData *d, const char *name)
+connection_requested (ConnmanData *d, const char *object_path)
 {
-  GHashTable *props;
-  const char *object_path;
+  ConnmanServices *services = NULL;
+
+  if (session.connman)
+    services = mtn_connman_get_services (session.connman);
 
-  if (!(props = g_hash_table_lookup (d->services, name)))
+  /* the list is live, the network may have gone since it was shown */
+  if (!services || !connman_services_lookup (services, object_path))
     {
-      g_warning ("Unknown service '%s'", name);
+      output (PROMPT "The network is no longer available.\n");
+      wifi_done (d, FALSE);
       return;
     }
 
-
-  if (!(object_path = g_hash_table_lookup (props, "DbusPath")))
+  /* connman may need to ask the agent for the credentials */
+  if (!session.agent_registered)
     {
-      g_warning ("No object path in connection request");
+      d->connect_key = object_path;
       return;
     }
 
+  d->connect_key = NULL;
+
   if (d->service)
     {
       g_signal_handlers_disconnect_by_data (d->service, d);
@@ -642,75 +1033,138 @@ connection_requested (ConnmanData *d, const char *name)
       d->service = NULL;
     }
 
-  mtn_connman_service_new (object_path, NULL, connman_service_new_cb, d);
+  mtn_connman_service_new (object_path, d->cancellable, connman_service_new_cb,
+                           connman_data_ref (d));
 }
 
 static void
-connman_init (ConnmanData *d)
+session_start (void)
 {
-  mtn_connman_new (NULL, connman_new_cb, d);
-};
+  static guint serial = 0;
+
+  session.serial  = ++serial;
+  session.state   = SESSION_STARTING;
+  session.pending = 2;
+
+  output (PROMPT "Connecting to connman ...\n");
+
+  session.name_id = g_bus_own_name (G_BUS_TYPE_SYSTEM,
+                                    "org.guacamayo-project.ConnmanAgent",
+                                    G_BUS_NAME_OWNER_FLAGS_NONE,
+                                    NULL,
+                                    NULL,
+                                    NULL,
+                                    NULL,
+                                    NULL);
+
+  g_bus_get (G_BUS_TYPE_SYSTEM, NULL, agent_bus_acquired,
+             GUINT_TO_POINTER (session.serial));
+  mtn_connman_new (NULL, connman_new_cb, GUINT_TO_POINTER (session.serial));
+}
 
-static void
-connman_deinit (ConnmanData *d)
+/*
+ * Unregisters the agent and drops the session; called on exit. There is no
+ * waiting for the reply, the call only needs to be on its way.
+ */
+void
+connman_shutdown (void)
 {
-  GVariant *o;
+  if (session.agent_registered)
+    {
+      mtn_connman_unregister_agent (session.connman, AGENT_PATH);
+      g_dbus_connection_flush_sync (session.connection, NULL, NULL);
+    }
 
-  if (!d->connman)
-    return;
+  session_reset ();
+}
+
+static gboolean
+wifi_finish_cb (gpointer data)
+{
+  ConnmanData *d = data;
+  gboolean     success = d->success;
+
+  if (d->agent_input_invocation)
+    cancel_input (d, "Cancelled");
 
   if (d->service)
     g_signal_handlers_disconnect_by_data (d->service, d);
 
-  o = g_variant_new ("(o)", "/org/GuacamayoProject/ConnmanAgent");
+  stop_live_list (d);
+  g_cancellable_cancel (d->cancellable);
 
-  g_dbus_proxy_call_sync (G_DBUS_PROXY (d->connman), "UnregisterAgent", o,
-                          G_DBUS_CALL_FLAGS_NONE, 120000, NULL, NULL);
+  if (current == d)
+    current = NULL;
 
-  g_dbus_connection_unregister_object (d->connection, d->object_id);
-  g_bus_unown_name (d->name_id);
+  connman_data_unref (d);
 
-  while (g_main_context_pending (g_main_loop_get_context (d->loop)))
-    g_main_context_iteration (g_main_loop_get_context (d->loop), FALSE);
+  command_done (success);
 
-  if (d->service)
-    {
-      g_object_unref (d->service);
-      d->service = NULL;
-    }
+  return FALSE;
+}
 
-  g_hash_table_destroy (d->services);
-  d->services = NULL;
+/*
+ * Ends the wifi command; the teardown is done from an idle callback, as we
+ * usually get here from the callbacks of the objects being torn down.
+ */
+static void
+wifi_done (ConnmanData *d, gboolean success)
+{
+  if (d->finish_id)
+    return;
 
-  g_object_unref (d->connman);
-  d->connman = NULL;
+  d->success   = success;
+  d->finish_id = g_idle_add (wifi_finish_cb, d);
 }
 
-gboolean
-setup_wifi (char *line)
+static void
+wifi_cancel (gpointer data)
 {
-  gboolean retval = TRUE;
-  ConnmanData *d = g_slice_new0 (ConnmanData);
+  ConnmanData *d = data;
 
-  /*
-   * The services hash is keyed by the service name (i.e., ssid) and holds
-   * hash table of the service properties. The actual key value is inside the
-   * property hash, so we do not free it when destroying the hash.
-   */
-  d->services = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                       NULL,
-                                       (GDestroyNotify)g_hash_table_destroy);
+  output (PROMPT "Cancelled.\n");
+  wifi_done (d, FALSE);
+}
 
-  d->loop = get_main_loop ();
+static gboolean
+setup_wifi (char *args)
+{
+  ConnmanData *d = g_slice_new0 (ConnmanData);
 
-  connman_init (d);
+  d->ref_count   = 1;
+  d->cancellable = g_cancellable_new ();
 
-  g_main_loop_run (d->loop);
+  /* optionally, only the given number of the strongest networks is listed */
+  if (args && *args)
+    d->limit = MAX (strtol (args, NULL, 10), 0);
 
-  connman_deinit (d);
+  current = d;
+  command_defer (wifi_cancel, d);
 
-  g_slice_free (ConnmanData, d);
+  switch (session.state)
+    {
+    case SESSION_READY:
+      list_services (d);
+      break;
+    case SESSION_STARTING:
+      /* a cancelled command left it going, we carry on once it is ready */
+      break;
+    case SESSION_NONE:
+      session_start ();
+      break;
+    }
 
-  return retval;
+  return TRUE;
 }
 
+static const GuacaCmd cmds[] =
+{
+  {"wifi", "[N]", "Connect to wifi, listing the N strongest networks",
+   setup_wifi, C_NONE},
+};
+
+void
+connman_register (void)
+{
+  command_register (NULL, cmds, G_N_ELEMENTS (cmds));
+}
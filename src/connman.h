@@ -17,6 +17,20 @@
 #ifndef GUACA_CONNMAN_H
 #define GUACA_CONNMAN_H
 
-gboolean setup_wifi (char *line);
+#include <glib.h>
+
+#include "connman-services.h"
+
+typedef struct _ConnmanList ConnmanList;
+
+void         connman_register    (void);
+void         connman_shutdown    (void);
+
+ConnmanList *connman_list_new    (const ConnmanService **services, guint n);
+void         connman_list_free   (ConnmanList *list);
+void         connman_list_print  (ConnmanList *list);
+guint        connman_list_update (ConnmanList     *list,
+                                  ConnmanServices *table,
+                                  guint            below);
 
 #endif
@@ -0,0 +1,578 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+/*
+ * The daemon serves the commands on a UNIX socket. The protocol is line based:
+ * each line the client sends is a command line, and the response is whatever
+ * the command printed, followed by a status line, '%ok' or '%error'. When the
+ * command asks for input, '%input <prompt>' is sent instead, and the next line
+ * from the client is the answer. Lines of the command output starting with
+ * '%' have it doubled, so they cannot be mistaken for status lines.
+ *
+ * Any number of clients can be connected; the commands share the global state
+ * of the shell, so the requests are queued and run one at a time, in the
+ * order they arrive. So that a client sitting at '%input' cannot hold up the
+ * others, the input is only waited for DAEMON_INPUT_TIMEOUT seconds; the
+ * command then gets no input, and the request fails with '%error'.
+ *
+ * Lines are limited to DAEMON_MAX_LINE bytes; a longer one gets '%error', and
+ * the client is disconnected.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "daemon.h"
+#include "command.h"
+
+#define DAEMON_INPUT_TIMEOUT 30
+#define DAEMON_MAX_LINE      4096
+
+typedef struct
+{
+  guint               ref_count;
+
+  GSocketConnection  *connection;
+  GInputStream       *input;
+  GOutputStream      *output;
+  GCancellable       *cancellable;
+
+  /* what has been read, and the part of a line read so far */
+  char                read_buf[1024];
+  GString            *line;
+
+  /* what is waiting to be written, and what is being written */
+  GString            *queued;
+  GString            *sending;
+  gsize               sent;
+
+  gboolean            writing;
+  gboolean            at_line_start;
+  gboolean            close_when_sent;
+  gboolean            closed;
+} DaemonClient;
+
+typedef struct
+{
+  DaemonClient *client;
+  char         *line;
+} DaemonRequest;
+
+static GSocketService     *service = NULL;
+static char               *socket_path = NULL;
+static GuacaDaemonRunFunc  run_func = NULL;
+
+static GQueue              requests = G_QUEUE_INIT;
+static DaemonClient       *active = NULL;
+static guint               next_id = 0;
+
+static GuacaInputFunc      input_cb = NULL;
+static gpointer            input_data = NULL;
+static guint               input_timeout_id = 0;
+static gboolean            input_timed_out = FALSE;
+
+static void client_read (DaemonClient *client);
+static void client_send (DaemonClient *client);
+
+/*
+ * Hands the line, or NULL, to the command waiting for input.
+ */
+static void
+deliver_input (const char *line)
+{
+  GuacaInputFunc cb = input_cb;
+
+  if (input_timeout_id)
+    {
+      g_source_remove (input_timeout_id);
+      input_timeout_id = 0;
+    }
+
+  input_cb = NULL;
+  cb (line, input_data);
+}
+
+static gboolean
+input_timeout_cb (gpointer data)
+{
+  input_timeout_id = 0;
+  input_timed_out  = TRUE;
+
+  output ("Timed out waiting for input.\n");
+  deliver_input (NULL);
+
+  return FALSE;
+}
+
+static DaemonClient *
+client_ref (DaemonClient *client)
+{
+  client->ref_count++;
+  return client;
+}
+
+static void
+client_unref (DaemonClient *client)
+{
+  if (--client->ref_count)
+    return;
+
+  g_io_stream_close (G_IO_STREAM (client->connection), NULL, NULL);
+
+  g_object_unref (client->cancellable);
+  g_object_unref (client->connection);
+  g_string_free (client->line, TRUE);
+  g_string_free (client->queued, TRUE);
+  g_string_free (client->sending, TRUE);
+  g_slice_free (DaemonClient, client);
+}
+
+static void
+request_free (DaemonRequest *req)
+{
+  client_unref (req->client);
+  g_free (req->line);
+  g_slice_free (DaemonRequest, req);
+}
+
+/*
+ * Drops the requests of the client still queued, and interrupts the one in
+ * progress.
+ */
+static void
+client_drop_requests (DaemonClient *client)
+{
+  GList *l, *next;
+
+  for (l = requests.head; l; l = next)
+    {
+      DaemonRequest *req = l->data;
+
+      next = l->next;
+
+      if (req->client == client)
+        {
+          g_queue_delete_link (&requests, l);
+          request_free (req);
+        }
+    }
+
+  if (client == active)
+    {
+      if (input_cb)
+        deliver_input (NULL);
+      else
+        command_cancel ();
+    }
+}
+
+/*
+ * Drops the client; requests still queued are dropped, and the one in progress
+ * is interrupted, its result has nowhere to go. The connection itself is closed
+ * once the pending reads and writes are done with it.
+ */
+static void
+client_close (DaemonClient *client)
+{
+  if (client->closed)
+    return;
+
+  client->closed = TRUE;
+
+  g_cancellable_cancel (client->cancellable);
+  client_drop_requests (client);
+}
+
+static void
+write_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+  DaemonClient *client = data;
+  gssize        n;
+
+  client->writing = FALSE;
+
+  n = g_output_stream_write_finish (G_OUTPUT_STREAM (object), res, NULL);
+
+  if (n < 0)
+    client_close (client);
+  else
+    {
+      client->sent += n;
+      client_send (client);
+    }
+
+  client_unref (client);
+}
+
+/*
+ * The data being written must stay put until the write is done, so the
+ * output is collected in one buffer while the other is being sent.
+ */
+static void
+client_send (DaemonClient *client)
+{
+  if (client->closed || client->writing)
+    return;
+
+  if (client->sent == client->sending->len)
+    {
+      GString *t = client->sending;
+
+      g_string_truncate (t, 0);
+      client->sending = client->queued;
+      client->queued  = t;
+      client->sent    = 0;
+    }
+
+  if (!client->sending->len)
+    {
+      if (client->close_when_sent)
+        client_close (client);
+
+      return;
+    }
+
+  client->writing = TRUE;
+
+  g_output_stream_write_async (client->output,
+                               client->sending->str + client->sent,
+                               client->sending->len - client->sent,
+                               G_PRIORITY_DEFAULT, client->cancellable,
+                               write_cb, client_ref (client));
+}
+
+static void
+client_write (const char *str, gsize len, gpointer data)
+{
+  DaemonClient *client = data;
+  gsize         i;
+
+  if (client->closed)
+    return;
+
+  for (i = 0; i < len; i++)
+    {
+      if (client->at_line_start && str[i] == '%')
+        g_string_append_c (client->queued, '%');
+
+      g_string_append_c (client->queued, str[i]);
+      client->at_line_start = str[i] == '\n';
+    }
+
+  client_send (client);
+}
+
+/*
+ * Status lines are written as they are, on a line of their own.
+ */
+static void
+client_status (DaemonClient *client, const char *status)
+{
+  if (client->closed)
+    return;
+
+  if (!client->at_line_start)
+    g_string_append_c (client->queued, '\n');
+
+  g_string_append (client->queued, status);
+  g_string_append_c (client->queued, '\n');
+  client->at_line_start = TRUE;
+
+  client_send (client);
+}
+
+static gboolean
+next_request_cb (gpointer data)
+{
+  DaemonRequest *req;
+
+  next_id = 0;
+
+  if (active || !(req = g_queue_pop_head (&requests)))
+    return FALSE;
+
+  active = client_ref (req->client);
+  active->at_line_start = TRUE;
+
+  output_set_redirect (client_write, active);
+  run_func (req->line);
+
+  request_free (req);
+
+  return FALSE;
+}
+
+static void
+schedule_next (void)
+{
+  if (!next_id && !active && requests.length)
+    next_id = g_idle_add (next_request_cb, NULL);
+}
+
+static void
+client_line (DaemonClient *client, char *line, gsize len)
+{
+  DaemonRequest *req;
+
+  if (len && line[len - 1] == '\r')
+    line[--len] = 0;
+
+  if (client == active && input_cb)
+    deliver_input (line);
+  else
+    {
+      req = g_slice_new (DaemonRequest);
+      req->client = client_ref (client);
+      req->line   = g_strndup (line, len);
+
+      g_queue_push_tail (&requests, req);
+      schedule_next ();
+    }
+}
+
+/*
+ * We do not buffer more than DAEMON_MAX_LINE for anyone; the line gets
+ * '%error', and the client is dropped once that is sent.
+ */
+static void
+client_overflow (DaemonClient *client)
+{
+  static const char msg[] = "Line too long.\n";
+
+  client_drop_requests (client);
+
+  client_write (msg, sizeof (msg) - 1, client);
+  client_status (client, "%error");
+
+  client->close_when_sent = TRUE;
+  client_send (client);
+}
+
+static void
+read_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+  DaemonClient *client = data;
+  const char   *p, *end, *nl;
+  gssize        n;
+
+  n = g_input_stream_read_finish (G_INPUT_STREAM (object), res, NULL);
+
+  if (n <= 0)
+    {
+      client_close (client);
+      client_unref (client);
+      return;
+    }
+
+  for (p = client->read_buf, end = p + n; p < end; p = nl + 1)
+    {
+      if (!(nl = memchr (p, '\n', end - p)))
+        nl = end;
+
+      g_string_append_len (client->line, p, nl - p);
+
+      if (client->line->len > DAEMON_MAX_LINE)
+        {
+          client_overflow (client);
+          client_unref (client);
+          return;
+        }
+
+      if (nl == end)
+        break;
+
+      client_line (client, client->line->str, client->line->len);
+      g_string_truncate (client->line, 0);
+    }
+
+  if (!client->closed)
+    client_read (client);
+
+  client_unref (client);
+}
+
+static void
+client_read (DaemonClient *client)
+{
+  g_input_stream_read_async (client->input, client->read_buf,
+                             sizeof (client->read_buf), G_PRIORITY_DEFAULT,
+                             client->cancellable, read_cb,
+                             client_ref (client));
+}
+
+static gboolean
+incoming_cb (GSocketService    *service,
+             GSocketConnection *connection,
+             GObject           *source,
+             gpointer           data)
+{
+  DaemonClient *client = g_slice_new0 (DaemonClient);
+  GIOStream    *stream = G_IO_STREAM (connection);
+
+  client->ref_count     = 1;
+  client->connection    = g_object_ref (connection);
+  client->input         = g_io_stream_get_input_stream (stream);
+  client->output        = g_io_stream_get_output_stream (stream);
+  client->cancellable   = g_cancellable_new ();
+  client->line          = g_string_new (NULL);
+  client->queued        = g_string_new (NULL);
+  client->sending       = g_string_new (NULL);
+  client->at_line_start = TRUE;
+
+  client_read (client);
+  client_unref (client);
+
+  return TRUE;
+}
+
+/*
+ * Starts listening on the socket at path; a stale socket left behind by a
+ * previous run is replaced. Only the owner can connect.
+ */
+gboolean
+daemon_start (const char *path, GuacaDaemonRunFunc run, GError **error)
+{
+  GSocketAddress *address;
+  gboolean        retval;
+  mode_t          mask;
+
+  g_return_val_if_fail (!service, FALSE);
+
+  unlink (path);
+
+  service = g_socket_service_new ();
+  address = g_unix_socket_address_new (path);
+
+  mask = umask (0077);
+  retval = g_socket_listener_add_address (G_SOCKET_LISTENER (service), address,
+                                          G_SOCKET_TYPE_STREAM,
+                                          G_SOCKET_PROTOCOL_DEFAULT,
+                                          NULL, NULL, error);
+  umask (mask);
+
+  g_object_unref (address);
+
+  if (!retval)
+    {
+      g_object_unref (service);
+      service = NULL;
+      return FALSE;
+    }
+
+  socket_path = g_strdup (path);
+  run_func    = run;
+
+  g_signal_connect (service, "incoming", G_CALLBACK (incoming_cb), NULL);
+  g_socket_service_start (service);
+
+  return TRUE;
+}
+
+void
+daemon_stop (void)
+{
+  if (!service)
+    return;
+
+  g_socket_service_stop (service);
+  g_object_unref (service);
+  service = NULL;
+
+  unlink (socket_path);
+  g_free (socket_path);
+  socket_path = NULL;
+}
+
+/*
+ * Asks the client of the command in progress for a line of input; if none
+ * comes within DAEMON_INPUT_TIMEOUT seconds, cb gets NULL.
+ */
+void
+daemon_request_input (const char *prompt, GuacaInputFunc cb, gpointer data)
+{
+  char *status;
+
+  g_return_if_fail (active && !input_cb);
+
+  if (active->closed)
+    {
+      cb (NULL, data);
+      return;
+    }
+
+  input_cb   = cb;
+  input_data = data;
+
+  input_timeout_id = g_timeout_add_seconds (DAEMON_INPUT_TIMEOUT,
+                                            input_timeout_cb, NULL);
+
+  output_flush ();
+
+  status = g_strconcat ("%input ", prompt, NULL);
+  client_status (active, status);
+  g_free (status);
+}
+
+/*
+ * Reports the end of the command in progress to its client, and moves on to
+ * the next request; with close, the client is disconnected once the response
+ * is sent.
+ */
+void
+daemon_command_done (gboolean success, gboolean close)
+{
+  DaemonClient *client = active;
+
+  g_return_if_fail (client);
+
+  if (input_timeout_id)
+    {
+      g_source_remove (input_timeout_id);
+      input_timeout_id = 0;
+    }
+
+  input_cb   = NULL;
+  input_data = NULL;
+
+  output_set_redirect (NULL, NULL);
+
+  /* the command may take no input for an answer, but the client gave none */
+  if (input_timed_out)
+    success = FALSE;
+
+  input_timed_out = FALSE;
+
+  client_status (client, success ? "%ok" : "%error");
+
+  if (close)
+    {
+      client->close_when_sent = TRUE;
+      client_send (client);
+    }
+
+  active = NULL;
+  client_unref (client);
+
+  schedule_next ();
+}
@@ -0,0 +1,39 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_DAEMON_H
+#define GUACA_DAEMON_H
+
+#include <glib.h>
+
+#include "main.h"
+
+/*
+ * Runs a command line on behalf of a client; the command reports back through
+ * daemon_command_done().
+ */
+typedef void (*GuacaDaemonRunFunc) (const char *line);
+
+gboolean daemon_start         (const char          *path,
+                               GuacaDaemonRunFunc   run,
+                               GError             **error);
+void     daemon_stop          (void);
+void     daemon_request_input (const char     *prompt,
+                               GuacaInputFunc  cb,
+                               gpointer        data);
+void     daemon_command_done  (gboolean success, gboolean close);
+
+#endif
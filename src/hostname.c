@@ -28,22 +28,17 @@
 
 #include "main.h"
 #include "hostname.h"
+#include "command.h"
+#include "json.h"
 
-gboolean
-set_hostname (char *line)
+static gboolean
+set_hostname (char *args)
 {
   gboolean retval = TRUE;
-  char *p = line;
+  char *p = args;
   char *n;
   int   i, j, len;
 
-  /* skip command and any traling space */
-  while (*p && !isspace (*p))
-    p++;
-
-  while (*p && isspace (*p))
-    p++;
-
   if (!*p)
     {
       char buf[256];
@@ -55,6 +50,7 @@ set_hostname (char *line)
         }
 
       output ("Hostname: %s\n", buf);
+      json_string ("hostname", buf);
       return TRUE;
     }
 
@@ -84,6 +80,7 @@ set_hostname (char *line)
        * the hostname is read from /etc/hostname, so fix that too.
        */
       output ("Host name set to '%s'\n", n);
+      json_string ("hostname", n);
 
       if (!(f = fopen ("/etc/hostname", "w")))
         {
@@ -104,3 +101,14 @@ set_hostname (char *line)
 
   return retval;
 }
+
+static const GuacaCmd cmds[] =
+{
+  {"hostname", "[new name]", "Get/set host name", set_hostname, C_NONE},
+};
+
+void
+hostname_register (void)
+{
+  command_register (NULL, cmds, G_N_ELEMENTS (cmds));
+}
@@ -17,6 +17,6 @@
 #ifndef GUACA_HOSTNAME_H
 #define GUACA_HOSTNAME_H
 
-gboolean set_hostname (char *line);
+void hostname_register (void);
 
 #endif
@@ -0,0 +1,255 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "json.h"
+#include "output.h"
+
+#define JSON_MAX_DEPTH 16
+
+static gboolean  json_enabled = FALSE;
+
+/* nesting, and whether anything was written at each level yet */
+static guint     json_depth = 0;
+static gboolean  json_started[JSON_MAX_DEPTH];
+
+static GString  *json_buf = NULL;
+
+void
+json_set_enabled (gboolean enabled)
+{
+  json_enabled = enabled;
+}
+
+gboolean
+json_is_enabled (void)
+{
+  return json_enabled;
+}
+
+/*
+ * Appends the string as a JSON string literal; bytes that are not valid UTF-8
+ * (SSIDs can be anything) are replaced by U+FFFD.
+ */
+static void
+append_escaped (GString *buf, const char *str)
+{
+  const char *p = str;
+  const char *end = str + strlen (str);
+
+  g_string_append_c (buf, '"');
+
+  while (p < end)
+    {
+      const char *valid;
+
+      g_utf8_validate (p, end - p, &valid);
+
+      for (; p < valid; p++)
+        {
+          unsigned char c = *p;
+
+          switch (c)
+            {
+            case '"':
+              g_string_append (buf, "\\\"");
+              break;
+            case '\\':
+              g_string_append (buf, "\\\\");
+              break;
+            case '\n':
+              g_string_append (buf, "\\n");
+              break;
+            case '\r':
+              g_string_append (buf, "\\r");
+              break;
+            case '\t':
+              g_string_append (buf, "\\t");
+              break;
+            default:
+              if (c < 0x20)
+                g_string_append_printf (buf, "\\u%04x", c);
+              else
+                g_string_append_c (buf, c);
+            }
+        }
+
+      if (p < end)
+        {
+          g_string_append (buf, "\\ufffd");
+          p++;
+        }
+    }
+
+  g_string_append_c (buf, '"');
+}
+
+/*
+ * Starts a value; takes care of the separator and of the member name.
+ */
+static GString *
+begin_value (const char *name)
+{
+  if (!json_buf)
+    json_buf = g_string_new (NULL);
+
+  g_string_truncate (json_buf, 0);
+
+  if (json_depth)
+    {
+      if (json_started[json_depth - 1])
+        g_string_append_c (json_buf, ',');
+
+      json_started[json_depth - 1] = TRUE;
+    }
+
+  if (name)
+    {
+      append_escaped (json_buf, name);
+      g_string_append_c (json_buf, ':');
+    }
+
+  return json_buf;
+}
+
+static void
+end_value (void)
+{
+  /* one top level value per line */
+  if (!json_depth)
+    g_string_append_c (json_buf, '\n');
+
+  output_write (json_buf->str, json_buf->len);
+}
+
+static void
+begin_container (const char *name, char open)
+{
+  g_return_if_fail (json_depth < JSON_MAX_DEPTH);
+
+  g_string_append_c (begin_value (name), open);
+  output_write (json_buf->str, json_buf->len);
+
+  json_started[json_depth++] = FALSE;
+}
+
+static void
+end_container (char close)
+{
+  g_return_if_fail (json_depth > 0);
+
+  json_depth--;
+
+  g_string_truncate (json_buf, 0);
+  g_string_append_c (json_buf, close);
+  end_value ();
+}
+
+void
+json_begin_object (const char *name)
+{
+  if (json_enabled)
+    begin_container (name, '{');
+}
+
+void
+json_end_object (void)
+{
+  if (json_enabled)
+    end_container ('}');
+}
+
+void
+json_begin_array (const char *name)
+{
+  if (json_enabled)
+    begin_container (name, '[');
+}
+
+void
+json_end_array (void)
+{
+  if (json_enabled)
+    end_container (']');
+}
+
+/*
+ * A NULL value is written as null.
+ */
+void
+json_string (const char *name, const char *value)
+{
+  GString *buf;
+
+  if (!json_enabled)
+    return;
+
+  buf = begin_value (name);
+
+  if (value)
+    append_escaped (buf, value);
+  else
+    g_string_append (buf, "null");
+
+  end_value ();
+}
+
+void
+json_int (const char *name, gint64 value)
+{
+  if (!json_enabled)
+    return;
+
+  g_string_append_printf (begin_value (name), "%" G_GINT64_FORMAT, value);
+  end_value ();
+}
+
+void
+json_double (const char *name, double value)
+{
+  char     num[G_ASCII_DTOSTR_BUF_SIZE];
+  GString *buf;
+
+  if (!json_enabled)
+    return;
+
+  buf = begin_value (name);
+
+  /* JSON has no representation for these */
+  if (isnan (value) || isinf (value))
+    g_string_append (buf, "null");
+  else
+    g_string_append (buf, g_ascii_formatd (num, sizeof (num), "%.6g", value));
+
+  end_value ();
+}
+
+void
+json_bool (const char *name, gboolean value)
+{
+  if (!json_enabled)
+    return;
+
+  g_string_append (begin_value (name), value ? "true" : "false");
+  end_value ();
+}
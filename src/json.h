@@ -0,0 +1,43 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_JSON_H
+#define GUACA_JSON_H
+
+#include <glib.h>
+
+/*
+ * Streaming JSON writer on top of output(); values are written out as they
+ * are added, nothing is held back beyond the nesting. Members of objects are
+ * given a name, array elements are passed a NULL name.
+ *
+ * All the functions are no-ops unless JSON output is enabled, so commands
+ * can describe their results unconditionally.
+ */
+void     json_set_enabled  (gboolean enabled);
+gboolean json_is_enabled   (void);
+
+void     json_begin_object (const char *name);
+void     json_end_object   (void);
+void     json_begin_array  (const char *name);
+void     json_end_array    (void);
+
+void     json_string       (const char *name, const char *value);
+void     json_int          (const char *name, gint64 value);
+void     json_double       (const char *name, double value);
+void     json_bool         (const char *name, gboolean value);
+
+#endif
@@ -18,7 +18,6 @@
 #include "config.h"
 #endif
 
-#include <stdarg.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,8 +26,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <readline/readline.h>
-#include <readline/history.h>
 #include <glib.h>
+#include <glib-unix.h>
 
 #ifdef HAVE_GUACAMAYO_VERSION_H
 #include <guacamayo-version.h>
@@ -37,6 +36,10 @@
 #endif
 
 #include "main.h"
+#include "command.h"
+#include "json.h"
+#include "daemon.h"
+#include "cmdhistory.h"
 #include "hostname.h"
 #include "timezone.h"
 #include "connman.h"
@@ -44,77 +47,36 @@
 
 static FILE      *out = NULL;
 static FILE      *in  = NULL;
-static char      *history_file = NULL;
 static GMainLoop *loop = NULL;
 
-static gboolean   print_help (char *line);
-static gboolean   print_version (char *line);
-static gboolean   shutdown (char *line);
+static gboolean   quit_requested = FALSE;
 
-typedef gboolean (*GuacaCmdFunc) (char *);
+/* batch mode, commands come from -c, -f or a non-tty stdin */
+static char      *batch_cmds = NULL;
+static char      *batch_file = NULL;
+static FILE      *batch_in = NULL;
 
-void
-output (const char *fmt, ...)
-{
-  va_list args;
-
-  va_start (args, fmt);
+static gboolean   json_mode = FALSE;
 
-  if (out)
-    vfprintf (out, fmt, args);
-  else
-    vfprintf (stdout, fmt, args);
+/* daemon mode, commands come from the clients of the socket */
+static char      *daemon_socket = NULL;
 
-  va_end (args);
-}
-
-/*
- * C_DEBUG:  only shown in help in debug build, but no restrictions on
- *           availability per se.
- *
- * C_HIDDEN: never shown in help output
- *
- * C_SHELL:  in non-debug build only available if running under shell; in
- *           debug build all commands are always available.
- */
-enum
+static GOptionEntry options[] =
 {
-  C_NONE   = 0,
-  C_DEBUG  = 0x00000001,
-  C_HIDDEN = 0x00000002,
-  C_SHELL  = 0x00000004,
-};
-
-typedef struct
-{
-  const char   *cmd;
-  const char   *args;
-  const char   *help;
-  GuacaCmdFunc  func;
-  guint         flags;
-} GuacaCmd;
-
-/*
- * Keep sorted !!!
- */
-static GuacaCmd cmds[] =
-{
-  {"?",        NULL,         "Print help message", print_help,   C_HIDDEN},
-  {"help",     NULL,         "Print help message", print_help,   C_NONE},
-  {"hostname", "[new name]", "Get/set host name",  set_hostname, C_NONE},
-  {"quit",     NULL,         "Quit",               NULL,         C_SHELL},
-  {"reboot",   NULL,         "Reboot",             shutdown,     C_NONE},
-  {"shutdown", NULL,         "Shutdown",           shutdown,     C_NONE},
-  {"timezone", NULL,         "Set timezone",       set_timezone, C_NONE},
-  {"version",  NULL,         "Guacamayo version",  print_version,C_NONE},
-  {"wifi",     NULL,         "Connect to wifi",    setup_wifi,   C_NONE},
+  {"command", 'c', 0, G_OPTION_ARG_STRING, &batch_cmds,
+   "Run the ';' separated commands and exit", "COMMANDS"},
+  {"file", 'f', 0, G_OPTION_ARG_FILENAME, &batch_file,
+   "Run the commands in the script and exit", "FILE"},
+  {"json", 'j', 0, G_OPTION_ARG_NONE, &json_mode,
+   "Print the results as JSON, one object per command", NULL},
+  {"daemon", 'd', 0, G_OPTION_ARG_FILENAME, &daemon_socket,
+   "Serve commands on the UNIX socket", "SOCKET"},
+  {NULL}
 };
 
 static gboolean
 is_cmd_available (guint flags)
 {
-  gboolean visible;
-
   /* In debug mode all commands are available */
 #ifdef DEBUG
   return TRUE;
@@ -130,8 +92,6 @@ is_cmd_available (guint flags)
 static gboolean
 is_cmd_visible (guint flags)
 {
-  gboolean visible;
-
   /* Hidden commands are never visible. */
   if ((flags & C_HIDDEN))
     return FALSE;
@@ -146,75 +106,104 @@ is_cmd_visible (guint flags)
 }
 
 static gboolean
-print_version (char *line)
+print_version (char *args)
 {
 #ifdef HAVE_GUACAMAYO_VERSION_H
   output (GUACAMAYO_DISTRO_STRING "\n");
+  json_string ("version", GUACAMAYO_DISTRO_STRING);
 #else
   output ("Sorry mate, this ain't a Guacamayo build.\n");
+  json_string ("version", NULL);
 #endif
+
+  return TRUE;
 }
 
-static gboolean
-print_help (char *line)
+static void
+help_width_cb (const char *name, const GuacaCmd *cmd, gpointer data)
 {
-  int i;
-  static char fmt_str[20];
-  static int max_len = 0;
+  int *max_len = data;
+  int  len;
 
-  if (!max_len)
-    {
-      for (i = 0; i < G_N_ELEMENTS (cmds); i++)
-        {
-          int len;
+  if (!is_cmd_visible (cmd->flags))
+    return;
 
-          if (!is_cmd_visible (cmds[i].flags))
-            continue;
+  len = strlen (name);
 
-          len = strlen (cmds[i].cmd);
+  if (cmd->args)
+    len += (strlen (cmd->args) + 1);
 
-          if (cmds[i].args)
-            len += (strlen (cmds[i].args) + 1);
+  *max_len = MAX (*max_len, len);
+}
 
-          max_len = MAX (max_len, len);
-        }
+static void
+help_line_cb (const char *name, const GuacaCmd *cmd, gpointer data)
+{
+  const char *fmt_str = data;
 
-      snprintf (fmt_str, sizeof(fmt_str), "    %%-%ds: %%s\n", max_len);
+  if (!is_cmd_visible (cmd->flags))
+    return;
+
+  if (cmd->args)
+    {
+      char *t = g_strdup_printf ("%s %s", name, cmd->args);
+      output (fmt_str, t, cmd->help);
+      g_free (t);
     }
+  else
+    output (fmt_str, name, cmd->help);
+}
 
-  output ("Available Commands:\n\n");
+static void
+help_json_cb (const char *name, const GuacaCmd *cmd, gpointer data)
+{
+  if (!is_cmd_visible (cmd->flags))
+    return;
+
+  json_begin_object (NULL);
+  json_string ("command", name);
+  json_string ("args", cmd->args);
+  json_string ("help", cmd->help);
+  json_end_object ();
+}
+
+static gboolean
+print_help (char *args)
+{
+  static char fmt_str[20];
+  static int max_len = 0;
 
-  for (i = 0; i < G_N_ELEMENTS (cmds); i++)
+  if (json_is_enabled ())
     {
-      if (!is_cmd_visible (cmds[i].flags))
-        continue;
+      json_begin_array ("commands");
+      command_foreach (help_json_cb, NULL);
+      json_end_array ();
 
-      if (cmds[i].args)
-        {
-          char *t = g_strdup_printf ("%s %s", cmds[i].cmd, cmds[i].args);
-          output (fmt_str, t, cmds[i].help);
-          g_free (t);
-        }
-      else
-        output (fmt_str, cmds[i].cmd, cmds[i].help);
+      return TRUE;
+    }
+
+  if (!max_len)
+    {
+      command_foreach (help_width_cb, &max_len);
+      snprintf (fmt_str, sizeof(fmt_str), "    %%-%ds: %%s\n", max_len);
     }
 
+  output ("Available Commands:\n\n");
+
+  command_foreach (help_line_cb, fmt_str);
+
   output ("\n");
 
   return TRUE;
 }
 
 static gboolean
-shutdown (char *line)
+run_shutdown (const char *param)
 {
-  const char *param = "-r";
   char       *cmdline;
   GError     *error = NULL;
   gboolean    retval = TRUE;
 
-  if (!strncmp (line, "shutdown", strlen ("shutdown")))
-    param = "-h";
-
   cmdline = g_strdup_printf ("/sbin/shutdown %s now", param);
 
   if (!g_spawn_command_line_async (cmdline, &error))
@@ -229,86 +218,395 @@ shutdown (char *line)
 }
 
 static gboolean
-parse_line (char *line)
+reboot (char *args)
+{
+  return run_shutdown ("-r");
+}
+
+static gboolean
+shutdown (char *args)
+{
+  return run_shutdown ("-h");
+}
+
+static gboolean
+quit (char *args)
+{
+  quit_requested = TRUE;
+  return TRUE;
+}
+
+static const GuacaCmd cmds[] =
+{
+  {"?",        NULL,         "Print help message", print_help,   C_HIDDEN},
+  {"help",     NULL,         "Print help message", print_help,   C_NONE},
+  {"quit",     NULL,         "Quit",               quit,         C_SHELL},
+  {"reboot",   NULL,         "Reboot",             reboot,       C_NONE},
+  {"shutdown", NULL,         "Shutdown",           shutdown,     C_NONE},
+  {"version",  NULL,         "Guacamayo version",  print_version,C_NONE},
+};
+
+/*
+ * Input; the prompt is only installed while we are waiting for a line, i.e.,
+ * between commands or on request_input(), and readline is fed from the main
+ * loop, so D-Bus traffic and timers are serviced while at the prompt.
+ */
+static GuacaInputFunc  input_cb = NULL;
+static gpointer        input_data = NULL;
+static guint           input_watch_id = 0;
+
+static void line_handler (char *line);
+static void next_command (void);
+
+/*
+ * Reads a line from the batch input, NULL at the end of it; the line is to be
+ * freed with free().
+ */
+static char *
+read_batch_line (void)
+{
+  char    *line = NULL;
+  size_t   size = 0;
+  ssize_t  len;
+
+  output_flush ();
+
+  if ((len = getline (&line, &size, batch_in)) < 0)
+    {
+      free (line);
+      return NULL;
+    }
+
+  if (len && line[len - 1] == '\n')
+    line[len - 1] = 0;
+
+  return line;
+}
+
+static gboolean
+input_ready_cb (GIOChannel *source, GIOCondition condition, gpointer data)
 {
-  char   *l = g_strstrip (line);
-  char   *p = l;
-  size_t  n = -1;
-  gboolean success = FALSE;
-  int     i;
+  rl_callback_read_char ();
+
+  return TRUE;
+}
 
-  switch (*l)
+static void
+show_prompt (const char *prompt)
+{
+  output_flush ();
+  rl_callback_handler_install (prompt, line_handler);
+
+  if (!input_watch_id)
     {
-    case 0:
-      /* print help on empty lines */
-    case '?':
-      print_help (line);
-      return FALSE;
-    default:;
+      GIOChannel *channel = g_io_channel_unix_new (fileno (rl_instream));
+
+      input_watch_id = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                       input_ready_cb, NULL);
+      g_io_channel_unref (channel);
     }
+}
 
-  while (*p && !isspace (*p))
-    p++;
-
-  n = p - l;
-
-  for (i = 0; i < G_N_ELEMENTS (cmds); i++)
-    if (!strncmp (cmds[i].cmd, line, n))
-      {
-        if (!is_cmd_available (cmds[i].flags))
-          {
-            output ("Sorry mate, can't let you do that.\n");
-            success = FALSE;
-          }
-        else
-          success = cmds[i].func (line);
-        break;
-      }
+static void
+hide_prompt (void)
+{
+  if (input_watch_id)
+    {
+      g_source_remove (input_watch_id);
+      input_watch_id = 0;
+    }
+
+  rl_callback_handler_remove ();
+}
+
+static void
+deliver_input (const char *line)
+{
+  GuacaInputFunc cb   = input_cb;
+  gpointer       data = input_data;
+
+  input_cb   = NULL;
+  input_data = NULL;
+
+  cb (line, data);
+}
+
+static gboolean
+batch_input_cb (gpointer data)
+{
+  char *line;
+
+  /* the command might have been interrupted in the meantime */
+  if (!input_cb)
+    return FALSE;
 
-  if (success)
+  line = read_batch_line ();
+  deliver_input (line);
+  free (line);
+
+  return FALSE;
+}
+
+/*
+ * Prompts for a line of input on behalf of the command in progress; cb gets the
+ * line, or NULL if there is no more input or the command was interrupted. In
+ * batch mode the input comes from the batch stream, so scripts supply the
+ * answers after the command.
+ */
+void
+request_input (const char *prompt, GuacaInputFunc cb, gpointer data)
+{
+  if (daemon_socket)
     {
-      /* remove duplicates from history */
-      if (history_search_prefix (line, -1) >= 0)
+      daemon_request_input (prompt, cb, data);
+      return;
+    }
+
+  g_return_if_fail (!input_cb);
+
+  input_cb   = cb;
+  input_data = data;
+
+  if (batch_in)
+    g_idle_add (batch_input_cb, NULL);
+  else
+    show_prompt (prompt);
+}
+
+/*
+ * The command currently running, for the history; in JSON mode the text the
+ * command prints is collected as its message.
+ */
+static char     *cmd_line = NULL;
+static GString  *cmd_message = NULL;
+static gboolean  interrupted = FALSE;
+static int       exit_status = 0;
+
+static void
+command_done_cb (gboolean success, gpointer data)
+{
+  if (cmd_message)
+    {
+      output_set_capture (NULL);
+
+      if (cmd_message->len)
+        json_string ("message", cmd_message->str);
+
+      json_bool ("success", success);
+      json_end_object ();
+
+      g_string_free (cmd_message, TRUE);
+      cmd_message = NULL;
+    }
+
+  if (success && !batch_in && !daemon_socket && *cmd_line)
+    cmdhistory_add (cmd_line);
+
+  g_free (cmd_line);
+  cmd_line = NULL;
+
+  /* the command might have finished while still asking for input */
+  if (input_cb)
+    {
+      input_cb   = NULL;
+      input_data = NULL;
+
+      if (!batch_in)
+        hide_prompt ();
+    }
+
+  /* quit only ends the session of the client */
+  if (daemon_socket)
+    {
+      daemon_command_done (success, quit_requested);
+      quit_requested = FALSE;
+      return;
+    }
+
+  /* batches stop at the first failure */
+  if (batch_in && (!success || interrupted))
+    {
+      exit_status = 1;
+      g_main_loop_quit (loop);
+      return;
+    }
+
+  if (quit_requested)
+    {
+      g_main_loop_quit (loop);
+      return;
+    }
+
+  next_command ();
+}
+
+static void
+run_command (const char *line)
+{
+  cmd_line = g_strstrip (g_strdup (line));
+
+  /* each command is one object, whatever it reports goes inside it */
+  if (json_is_enabled ())
+    {
+      json_begin_object (NULL);
+      json_string ("command", cmd_line);
+
+      cmd_message = g_string_new (NULL);
+      output_set_capture (cmd_message);
+    }
+
+  /* print help on empty lines */
+  if (!*cmd_line)
+    {
+      print_help (cmd_line);
+      command_done_cb (TRUE, NULL);
+      return;
+    }
+
+  command_run (cmd_line, command_done_cb, NULL);
+}
+
+static void
+line_handler (char *line)
+{
+  hide_prompt ();
+
+  if (input_cb)
+    deliver_input (line);
+  else if (!line)
+    {
+      output ("\n");
+      g_main_loop_quit (loop);
+    }
+  else
+    run_command (line);
+
+  free (line);
+}
+
+/*
+ * Batch mode; -c gives all the commands up front, otherwise they are read a
+ * line at a time, each line holding one or more ';' separated commands.
+ */
+static char **batch_cmdv = NULL;
+static int    batch_pos = 0;
+
+static gboolean
+batch_next_cb (gpointer data)
+{
+  for (;;)
+    {
+      char *line;
+
+      while (batch_cmdv && batch_cmdv[batch_pos])
         {
-          int          pos = where_history ();
-          HIST_ENTRY * e;
+          char *l = g_strstrip (batch_cmdv[batch_pos++]);
 
-          if ((e = remove_history (pos)))
-            free_history_entry (e);
+          /* empty lines and comments */
+          if (!*l || *l == '#')
+            continue;
+
+          run_command (l);
+          return FALSE;
         }
 
-      add_history (line);
+      g_strfreev (batch_cmdv);
+      batch_cmdv = NULL;
+      batch_pos  = 0;
+
+      if (batch_cmds || !(line = read_batch_line ()))
+        break;
+
+      batch_cmdv = g_strsplit (line, ";", -1);
+      free (line);
     }
 
+  g_main_loop_quit (loop);
   return FALSE;
 }
 
+static void
+next_command (void)
+{
+  if (batch_in)
+    g_idle_add (batch_next_cb, NULL);
+  else
+    show_prompt (": ");
+}
+
+static int completion_start = 0;
+
 static char *
 command_match (const char *text, int state)
 {
-  static int i = 0;
+  return command_complete (rl_line_buffer, completion_start, text, state);
+}
 
-  if (!state)
-    i = 0;
+static char **
+guaca_completion (const char *text, int start, int end)
+{
+  completion_start = start;
 
-  for (; i < G_N_ELEMENTS (cmds); i++)
-    if (out && !g_strcmp0 (cmds[i].cmd, "quit"))
-      continue;
-    else if (!strncmp (text, cmds[i].cmd, strlen (text)))
-      return strdup (cmds[i++].cmd);
+  /* do not fall back on file name completion */
+  rl_attempted_completion_over = 1;
 
-  return NULL;
+  return rl_completion_matches (text, command_match);
 }
 
-static char **
-guaca_completion (const char *text, int start, int end)
+/*
+ * SIGINT is handled from the main loop; it interrupts the command in progress,
+ * and otherwise quits, unless we are running on a dedicated VT.
+ */
+static gboolean
+interrupt_cb (gpointer data)
 {
-  char **m = NULL;
+  if (daemon_socket)
+    {
+      g_main_loop_quit (loop);
+      return TRUE;
+    }
 
-  if (start == 0)
-    m = rl_completion_matches (text, command_match);
+  if (batch_in)
+    interrupted = TRUE;
 
-  return m;
+  if (command_is_running ())
+    {
+      if (input_cb)
+        {
+          output ("\n");
+
+          if (!batch_in)
+            hide_prompt ();
+
+          deliver_input (NULL);
+        }
+      else if (!command_cancel ())
+        output ("Sorry mate, can't let you do that.\n");
+    }
+  else if (out)
+    output ("Sorry mate, can't let you do that.\n");
+  else
+    {
+      if (batch_in)
+        exit_status = 1;
+
+      g_main_loop_quit (loop);
+    }
+
+  return TRUE;
+}
+
+/*
+ * SIGTERM is how a supervisor stops us; it too is handled from the main loop,
+ * so that the daemon and the output get cleaned up on the normal exit path.
+ */
+static gboolean
+terminate_cb (gpointer data)
+{
+  exit_status = SIGTERM;
+  g_main_loop_quit (loop);
+
+  return TRUE;
 }
 
 static void
@@ -319,20 +617,6 @@ signal_handler (int sig)
     default:
       break;
 
-    case SIGINT:
-      /* Terminate any subcommands using the glib main loop. */
-      g_main_loop_quit (loop);
-
-      /*
-       * disable SIGINT if we are running on a dedicated VT, otherwise fall
-       * through
-       */
-      if (out)
-        {
-          output ("Sorry mate, can't let you do that.\n");
-          return;
-        }
-
     case SIGABRT:
     case SIGSEGV:
     case SIGTERM:
@@ -344,41 +628,21 @@ signal_handler (int sig)
         fclose (in);
 
       vtmanager_deinit ();
-
-      if (history_file)
-        write_history (history_file);
     }
 
   exit (sig);
 }
 
-GMainLoop *
-get_main_loop (void)
-{
-  return loop;
-}
-
-int
-main (int argc, char **argv)
+static void
+run_interactive (void)
 {
-  int               rows, cols;
-  const char       *home;
-  char             *line;
-  const char       *tty;
-  struct sigaction  sa;
-
-  sigfillset(&sa.sa_mask);
-  sa.sa_handler = signal_handler;
-  sigaction(SIGTERM, &sa, NULL);
-  sigaction(SIGSEGV, &sa, NULL);
-  sigaction(SIGABRT, &sa, NULL);
-  sigaction(SIGINT, &sa, NULL);
+  int         rows, cols;
+  const char *home;
+  const char *tty;
 
   tty = vtmanager_init ();
   vtmanager_activate ();
 
-  g_type_init ();
-
   rl_initialize();
 
   if (tty)
@@ -389,6 +653,7 @@ main (int argc, char **argv)
             fclose (rl_outstream);
 
           rl_outstream = out;
+          output_set_stream (out);
         }
 
       if ((in = fopen (tty, "r")))
@@ -400,40 +665,42 @@ main (int argc, char **argv)
         }
     }
 
+  if (!rl_instream)
+    rl_instream = stdin;
+
   rl_attempted_completion_function = guaca_completion;
   rl_get_screen_size (&rows, &cols);
 
+  output_set_screen_size (rows, cols);
+  output_set_cursor_addressing (isatty (fileno (out ? out : stdout)) &&
+                                g_strcmp0 (g_getenv ("TERM"), "dumb"));
+
   if ((home = getenv ("HOME")))
     {
-      using_history ();
+      char *history_file = g_build_filename (home, ".guaca-cli-history", NULL);
 
-      history_file = g_build_filename (home, ".guaca-cli-history", NULL);
-      read_history (history_file);
+      cmdhistory_load (history_file);
+      g_free (history_file);
     }
+  else
+    cmdhistory_load (NULL);
 
-  /* main loop for use in commnds */
-  loop = g_main_loop_new (NULL, FALSE);
-
+  if (!json_is_enabled ())
+    {
 #ifdef HAVE_GUACAMAYO_VERSION_H
-  output ("Welcome to " GUACAMAYO_DISTRO_STRING "\n\n");
+      output ("Welcome to " GUACAMAYO_DISTRO_STRING "\n\n");
 #else
-  output ("\n\n");
+      output ("\n\n");
 #endif
 
-  print_help (NULL);
-
-  while ((line = readline (": ")))
-    {
-      if (parse_line (line))
-        break;
-
-      free (line);
+      print_help (NULL);
     }
 
-  if (history_file)
-    write_history (history_file);
+  show_prompt (": ");
+  g_main_loop_run (loop);
+  hide_prompt ();
 
-  g_free (history_file);
+  output_set_stream (NULL);
 
   if (out)
     fclose (out);
@@ -441,8 +708,99 @@ main (int argc, char **argv)
   if (in)
     fclose (in);
 
-  g_main_loop_unref (loop);
-
   vtmanager_deinit ();
 }
 
+int
+main (int argc, char **argv)
+{
+  GOptionContext   *context;
+  GError           *error = NULL;
+  struct sigaction  sa;
+
+  sigfillset(&sa.sa_mask);
+  sa.sa_handler = signal_handler;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGSEGV, &sa, NULL);
+  sigaction(SIGABRT, &sa, NULL);
+
+  context = g_option_context_new ("- Guacamayo configuration shell");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  if (daemon_socket)
+    {
+      if (batch_cmds || batch_file)
+        {
+          fprintf (stderr, "The daemon does not run batches\n");
+          return 1;
+        }
+    }
+  else if (batch_file)
+    {
+      if (!(batch_in = fopen (batch_file, "r")))
+        {
+          fprintf (stderr, "Failed to open %s: %s\n",
+                   batch_file, strerror (errno));
+          return 1;
+        }
+    }
+  else if (batch_cmds || !isatty (STDIN_FILENO))
+    batch_in = stdin;
+
+  g_type_init ();
+
+  json_set_enabled (json_mode);
+
+  command_register (NULL, cmds, G_N_ELEMENTS (cmds));
+  hostname_register ();
+  timezone_register ();
+  connman_register ();
+  command_set_filter (is_cmd_available);
+
+  /* the one main loop, for input and for the commands */
+  loop = g_main_loop_new (NULL, FALSE);
+
+  g_unix_signal_add (SIGINT, interrupt_cb, NULL);
+  g_unix_signal_add (SIGTERM, terminate_cb, NULL);
+
+  if (daemon_socket)
+    {
+      if (!daemon_start (daemon_socket, run_command, &error))
+        {
+          fprintf (stderr, "Failed to listen on %s: %s\n",
+                   daemon_socket, error->message);
+          return 1;
+        }
+
+      g_main_loop_run (loop);
+      daemon_stop ();
+    }
+  else if (batch_in)
+    {
+      if (batch_cmds)
+        batch_cmdv = g_strsplit (batch_cmds, ";", -1);
+
+      g_idle_add (batch_next_cb, NULL);
+      g_main_loop_run (loop);
+    }
+  else
+    run_interactive ();
+
+  connman_shutdown ();
+  output_flush ();
+
+  if (batch_in && batch_in != stdin)
+    fclose (batch_in);
+
+  g_main_loop_unref (loop);
+
+  return exit_status;
+}
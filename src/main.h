@@ -19,7 +19,11 @@
 
 #include <glib.h>
 
-GMainLoop *get_main_loop (void);
-void       output        (const char *fmt, ...);
+#include "output.h"
+
+/* line is NULL at the end of input, or when the command is interrupted */
+typedef void (*GuacaInputFunc) (const char *line, gpointer data);
+
+void request_input (const char *prompt, GuacaInputFunc cb, gpointer data);
 
 #endif
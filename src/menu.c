@@ -0,0 +1,185 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <string.h>
+#include <glib.h>
+
+#include "output.h"
+#include "menu.h"
+
+/*
+ * A numbered list of items, laid out in as many columns as fit the screen,
+ * numbered down the columns, and shown a screen at a time.
+ */
+
+/* lines kept free below a page for the question and the prompt */
+#define MENU_RESERVED_ROWS 3
+
+/* space between columns */
+#define MENU_GAP 3
+
+/* the indent of the items */
+#define MENU_INDENT "    "
+
+struct _GuacaMenu
+{
+  char      *prefix;
+  GPtrArray *items;
+  guint      width;  /* of the widest item, in characters */
+  guint      shown;  /* items shown so far */
+};
+
+/*
+ * prefix is printed at the start of each line
+ */
+GuacaMenu *
+menu_new (const char *prefix)
+{
+  GuacaMenu *menu = g_slice_new0 (GuacaMenu);
+
+  menu->prefix = g_strdup (prefix ? prefix : "");
+  menu->items  = g_ptr_array_new_with_free_func (g_free);
+
+  return menu;
+}
+
+void
+menu_free (GuacaMenu *menu)
+{
+  if (!menu)
+    return;
+
+  g_free (menu->prefix);
+  g_ptr_array_free (menu->items, TRUE);
+  g_slice_free (GuacaMenu, menu);
+}
+
+void
+menu_add (GuacaMenu *menu, const char *fmt, ...)
+{
+  va_list  args;
+  char    *item;
+
+  va_start (args, fmt);
+  item = g_strdup_vprintf (fmt, args);
+  va_end (args);
+
+  menu->width = MAX (menu->width, g_utf8_strlen (item, -1));
+
+  g_ptr_array_add (menu->items, item);
+}
+
+guint
+menu_get_length (GuacaMenu *menu)
+{
+  return menu->items->len;
+}
+
+gboolean
+menu_has_more (GuacaMenu *menu)
+{
+  return menu->shown < menu->items->len;
+}
+
+static guint
+n_digits (guint n)
+{
+  guint d = 1;
+
+  while (n >= 10)
+    {
+      n /= 10;
+      d++;
+    }
+
+  return d;
+}
+
+/*
+ * Shows the next page of the menu, starting from the first; returns FALSE if
+ * all of the menu has already been shown.
+ */
+gboolean
+menu_show_page (GuacaMenu *menu)
+{
+  GString *line;
+  int      rows, cols;
+  guint    num_w, col_w, avail;
+  guint    n_cols, n_rows, n;
+  guint    r, c;
+
+  if (!menu_has_more (menu))
+    return FALSE;
+
+  output_get_screen_size (&rows, &cols);
+
+  num_w = n_digits (menu->items->len);
+  col_w = num_w + 2 + menu->width;
+  avail = g_utf8_strlen (menu->prefix, -1) + strlen (MENU_INDENT);
+  avail = (guint) cols > avail ? cols - avail : 0;
+
+  n_cols = MAX (1, (avail + MENU_GAP) / (col_w + MENU_GAP));
+  n_rows = MAX (1, rows - MENU_RESERVED_ROWS);
+  n      = MIN (menu->items->len - menu->shown, n_cols * n_rows);
+
+  /* fill the columns evenly, rather than leave the last one short */
+  n_rows = (n + n_cols - 1) / n_cols;
+  n_cols = (n + n_rows - 1) / n_rows;
+
+  line = g_string_new (NULL);
+
+  for (r = 0; r < n_rows; r++)
+    {
+      g_string_assign (line, menu->prefix);
+      g_string_append (line, MENU_INDENT);
+
+      for (c = 0; c < n_cols; c++)
+        {
+          guint       i = c * n_rows + r;
+          const char *item;
+
+          if (i >= n)
+            break;
+
+          i   += menu->shown;
+          item = g_ptr_array_index (menu->items, i);
+
+          g_string_append_printf (line, "%*u: %s", num_w, i + 1, item);
+
+          /* pad up to the next column */
+          if (c + 1 < n_cols && (c + 1) * n_rows + r < n)
+            {
+              guint pad = menu->width - g_utf8_strlen (item, -1) + MENU_GAP;
+
+              while (pad--)
+                g_string_append_c (line, ' ');
+            }
+        }
+
+      output ("%s\n", line->str);
+    }
+
+  g_string_free (line, TRUE);
+
+  menu->shown += n;
+
+  return TRUE;
+}
@@ -0,0 +1,32 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_MENU_H
+#define GUACA_MENU_H
+
+#include <glib.h>
+
+typedef struct _GuacaMenu GuacaMenu;
+
+GuacaMenu *menu_new        (const char *prefix);
+void       menu_free       (GuacaMenu *menu);
+void       menu_add        (GuacaMenu *menu, const char *fmt, ...)
+                            G_GNUC_PRINTF (2, 3);
+guint      menu_get_length (GuacaMenu *menu);
+gboolean   menu_has_more   (GuacaMenu *menu);
+gboolean   menu_show_page  (GuacaMenu *menu);
+
+#endif
@@ -17,7 +17,7 @@
  */
 
 #include "mtn-connman-service.h"
-#include "connman-service-introspection.h"
+#include "connman-service-info.h"
 
 struct _MtnConnmanServicePrivate {
     GHashTable *properties;
@@ -232,19 +232,11 @@ mtn_connman_service_initable_init (GInitableIface *initable_iface)
     initable_iface->init = mtn_connman_service_initable_init_sync;
 }
 
+/* generated from connman-service.xml at build time */
 static GDBusInterfaceInfo *
 mtn_connman_service_get_interface_info (void)
 {
-    static gsize has_info = 0;
-    static GDBusInterfaceInfo *info = NULL;
-    if (g_once_init_enter (&has_info)) {
-        GDBusNodeInfo *introspection_data;
-        introspection_data = g_dbus_node_info_new_for_xml (connman_service_introspection,
-                                                           NULL);
-        info = introspection_data->interfaces[0];
-        g_once_init_leave (&has_info, 1);
-    }
-    return info;
+    return (GDBusInterfaceInfo *) &connman_service_interface;
 }
 
 static void
@@ -457,6 +449,44 @@ mtn_connman_service_set_property (MtnConnmanService *service,
     g_variant_unref (params);
 }
 
+/*
+ * Connect can take a while, as connman may have to ask the agent for the
+ * credentials first; the reply only comes once the service is connected.
+ */
+void
+mtn_connman_service_connect (MtnConnmanService   *service,
+                             int                  timeout_msec,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+    g_return_if_fail (MTN_IS_CONNMAN_SERVICE (service));
+
+    g_dbus_proxy_call (G_DBUS_PROXY (service),
+                       "Connect",
+                       NULL,
+                       G_DBUS_CALL_FLAGS_NONE,
+                       timeout_msec,
+                       cancellable,
+                       callback,
+                       user_data);
+}
+
+gboolean
+mtn_connman_service_connect_finish (MtnConnmanService  *service,
+                                    GAsyncResult       *res,
+                                    GError            **error)
+{
+    GVariant *var;
+
+    var = g_dbus_proxy_call_finish (G_DBUS_PROXY (service), res, error);
+    if (!var)
+        return FALSE;
+
+    g_variant_unref (var);
+    return TRUE;
+}
+
 MtnConnmanService *
 mtn_connman_service_new_finish (GAsyncResult  *res,
                                 GError       **error)
@@ -57,6 +57,9 @@ GType              mtn_connman_service_get_type     (void);
 GVariant*          mtn_connman_service_get_property (MtnConnmanService *service, const char *key);
 void               mtn_connman_service_set_property (MtnConnmanService *service, const char *key, GVariant *value);
 
+void               mtn_connman_service_connect        (MtnConnmanService *service, int timeout_msec, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+gboolean           mtn_connman_service_connect_finish (MtnConnmanService *service, GAsyncResult *res, GError **error);
+
 MtnConnmanService* mtn_connman_service_new_finish   (GAsyncResult *res, GError **error);
 void               mtn_connman_service_new          (const char *object_path, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
 
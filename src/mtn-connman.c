@@ -17,11 +17,14 @@
  */
 
 #include "mtn-connman.h"
-#include "connman-manager-introspection.h"
+#include "connman-manager-info.h"
 
 struct _MtnConnmanPrivate {
-    GHashTable *properties;
-    GVariant   *services;
+    GHashTable      *properties;
+
+    /* kept up to date from the ServicesChanged signals */
+    ConnmanServices *services;
+    gboolean         has_services;
 };
 
 static void mtn_connman_initable_init       (GInitableIface *initable_iface);
@@ -50,23 +53,58 @@ typedef struct {
     guint done_services : 1;
 } InitData;
 
+/*
+ * Takes the (a(oa{sv})) GetServices reply.
+ */
+static void
+mtn_connman_set_services (MtnConnman *connman,
+                          GVariant   *var)
+{
+    GVariant *list;
+
+    list = g_variant_get_child_value (var, 0);
+    connman_services_set_all (connman->priv->services, list);
+    connman->priv->has_services = TRUE;
+    g_variant_unref (list);
+}
+
+static void
+_services_reloaded_cb (GObject      *obj,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+    GError *error = NULL;
+
+    if (!mtn_connman_list_services_finish (MTN_CONNMAN (obj), res, &error)) {
+        g_warning ("GetServices() failed: %s", error->message);
+        g_error_free (error);
+    }
+}
+
 static void
 _name_owner_notify_cb (MtnConnman *connman,
                        GParamSpec *pspec,
                        gpointer    user_data)
 {
-    const char *name;
+    char *name;
 
     g_object_get (connman, "g-name-owner", &name, NULL);
 
     if (!name) {
         g_hash_table_remove_all (connman->priv->properties);
+        connman_services_clear (connman->priv->services);
+        connman->priv->has_services = FALSE;
         /* Could notify "property-changed:NNN" here but it would be
          * very difficult to get right... better let owner connect
          * to this same signal as well*/
     } else {
         /* TODO: get_properties and notify each */
+
+        /* the deltas are ignored until we have the full list again */
+        mtn_connman_list_services (connman, _services_reloaded_cb, NULL);
     }
+
+    g_free (name);
 }
 
 static void
@@ -131,7 +169,8 @@ _get_services_cb (GObject      *obj,
                    error->message);
         g_error_free (error);
     } else {
-      connman->priv->services = var;
+        mtn_connman_set_services (connman, var);
+        g_variant_unref (var);
     }
 
     if (data->done_props) {
@@ -275,7 +314,8 @@ mtn_connman_initable_init_sync (GInitable     *initable,
         return FALSE;
     }
 
-    connman->priv->services = var;
+    mtn_connman_set_services (connman, var);
+    g_variant_unref (var);
 
     return TRUE;
 }
@@ -286,19 +326,11 @@ mtn_connman_initable_init (GInitableIface *initable_iface)
     initable_iface->init = mtn_connman_initable_init_sync;
 }
 
+/* generated from connman-manager.xml at build time */
 static GDBusInterfaceInfo *
 mtn_connman_get_interface_info (void)
 {
-    static gsize has_info = 0;
-    static GDBusInterfaceInfo *info = NULL;
-    if (g_once_init_enter (&has_info)) {
-        GDBusNodeInfo *introspection_data;
-        introspection_data = g_dbus_node_info_new_for_xml (connman_manager_introspection,
-                                                           NULL);
-        info = introspection_data->interfaces[0];
-        g_once_init_leave (&has_info, 1);
-    }
-    return info;
+    return (GDBusInterfaceInfo *) &connman_manager_interface;
 }
 
 static void
@@ -342,14 +374,28 @@ mtn_connman_g_signal (GDBusProxy   *proxy,
         mtn_connman_handle_new_property (connman, key, value);
     }
     else if (g_strcmp0 (signal_name, "ServicesChanged") == 0) {
-        if (connman->priv->services)
-          g_variant_unref (connman->priv->services);
+        GVariant *changed, *removed;
+        gboolean  emit;
+
+        /* the deltas only make sense against a full list */
+        if (!connman->priv->has_services)
+            return;
 
-        /* get the first child from the (a(oa{sv})ao) tupple */
-        connman->priv->services = g_variant_get_child_value (parameters, 0);
+        /* the (a(oa{sv})ao) tuple; the first array lists all services, but
+         * only with the properties that changed, the second one the services
+         * removed */
+        changed = g_variant_get_child_value (parameters, 0);
+        removed = g_variant_get_child_value (parameters, 1);
 
-        g_signal_emit (connman, signals[SERVICES_CHANGED_SIGNAL], 0,
-                       parameters);
+        emit = connman_services_apply (connman->priv->services,
+                                       changed, removed);
+
+        g_variant_unref (changed);
+        g_variant_unref (removed);
+
+        if (emit)
+            g_signal_emit (connman, signals[SERVICES_CHANGED_SIGNAL], 0,
+                           parameters);
     }
 }
 
@@ -365,8 +411,10 @@ mtn_connman_dispose (GObject *object)
         connman->priv->properties = NULL;
     }
 
-    if (connman->priv->services)
-      g_variant_unref (connman->priv->services);
+    if (connman->priv->services) {
+        connman_services_free (connman->priv->services);
+        connman->priv->services = NULL;
+    }
 
     G_OBJECT_CLASS (mtn_connman_parent_class)->dispose (object);
 }
@@ -396,6 +444,8 @@ mtn_connman_class_init (MtnConnmanClass *klass)
                           G_TYPE_NONE,
                           1,
                           G_TYPE_VARIANT);
+    /* emitted once the service table has changed; the value is the
+     * ServicesChanged parameters, or NULL if the whole list was fetched */
     signals[SERVICES_CHANGED_SIGNAL] =
             g_signal_new ("services-changed",
                           MTN_TYPE_CONNMAN,
@@ -419,16 +469,124 @@ mtn_connman_init (MtnConnman *self)
                                    g_str_equal,
                                    g_free,
                                    NULL);
+
+    self->priv->services = connman_services_new ();
 }
 
-GVariant *
+/*
+ * The live service table, or NULL if we have not got the list from connman
+ * yet; the table is owned by the proxy, and "services-changed" is emitted
+ * whenever it changes.
+ */
+ConnmanServices *
 mtn_connman_get_services (MtnConnman *connman)
 {
     g_return_val_if_fail (MTN_IS_CONNMAN (connman), NULL);
 
+    if (!connman->priv->has_services)
+        return NULL;
+
     return connman->priv->services;
 }
 
+/*
+ * Typed wrappers for the Manager methods we call; the proxy checks the replies
+ * against the interface description.
+ */
+void
+mtn_connman_register_agent (MtnConnman          *connman,
+                            const char          *path,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+    g_return_if_fail (MTN_IS_CONNMAN (connman));
+    g_return_if_fail (g_variant_is_object_path (path));
+
+    g_dbus_proxy_call (G_DBUS_PROXY (connman),
+                       "RegisterAgent",
+                       g_variant_new ("(o)", path),
+                       G_DBUS_CALL_FLAGS_NONE,
+                       -1,
+                       NULL,
+                       callback,
+                       user_data);
+}
+
+gboolean
+mtn_connman_register_agent_finish (MtnConnman    *connman,
+                                   GAsyncResult  *res,
+                                   GError       **error)
+{
+    GVariant *var;
+
+    var = g_dbus_proxy_call_finish (G_DBUS_PROXY (connman), res, error);
+    if (!var)
+        return FALSE;
+
+    g_variant_unref (var);
+    return TRUE;
+}
+
+/*
+ * No reply is waited for; this is used on the way out.
+ */
+void
+mtn_connman_unregister_agent (MtnConnman *connman,
+                              const char *path)
+{
+    g_return_if_fail (MTN_IS_CONNMAN (connman));
+    g_return_if_fail (g_variant_is_object_path (path));
+
+    g_dbus_proxy_call (G_DBUS_PROXY (connman),
+                       "UnregisterAgent",
+                       g_variant_new ("(o)", path),
+                       G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                       -1,
+                       NULL,
+                       NULL,
+                       NULL);
+}
+
+void
+mtn_connman_list_services (MtnConnman          *connman,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+    g_return_if_fail (MTN_IS_CONNMAN (connman));
+
+    g_dbus_proxy_call (G_DBUS_PROXY (connman),
+                       "GetServices",
+                       NULL,
+                       G_DBUS_CALL_FLAGS_NONE,
+                       -1,
+                       NULL,
+                       callback,
+                       user_data);
+}
+
+/*
+ * The reply replaces the contents of the live service table, see
+ * mtn_connman_get_services().
+ */
+gboolean
+mtn_connman_list_services_finish (MtnConnman    *connman,
+                                  GAsyncResult  *res,
+                                  GError       **error)
+{
+    GVariant *var;
+
+    var = g_dbus_proxy_call_finish (G_DBUS_PROXY (connman), res, error);
+    if (!var)
+        return FALSE;
+
+    mtn_connman_set_services (connman, var);
+    g_variant_unref (var);
+
+    g_signal_emit (connman, signals[SERVICES_CHANGED_SIGNAL], 0, NULL);
+
+    return TRUE;
+}
+
 GVariant*
 mtn_connman_get_property (MtnConnman *connman, const char *key)
 {
@@ -21,6 +21,8 @@
 
 #include <gio/gio.h>
 
+#include "connman-services.h"
+
 G_BEGIN_DECLS
 
 #define MTN_TYPE_CONNMAN mtn_connman_get_type()
@@ -61,7 +63,13 @@ GType       mtn_connman_get_type     (void);
 
 GVariant*   mtn_connman_get_property (MtnConnman *connman, const char *key);
 void        mtn_connman_set_property (MtnConnman *connman, const char *key, GVariant *value);
-GVariant   *mtn_connman_get_services (MtnConnman *connman);
+ConnmanServices *mtn_connman_get_services (MtnConnman *connman);
+
+void        mtn_connman_register_agent        (MtnConnman *connman, const char *path, GAsyncReadyCallback callback, gpointer user_data);
+gboolean    mtn_connman_register_agent_finish (MtnConnman *connman, GAsyncResult *res, GError **error);
+void        mtn_connman_unregister_agent      (MtnConnman *connman, const char *path);
+void        mtn_connman_list_services         (MtnConnman *connman, GAsyncReadyCallback callback, gpointer user_data);
+gboolean    mtn_connman_list_services_finish  (MtnConnman *connman, GAsyncResult *res, GError **error);
 
 MtnConnman* mtn_connman_new_finish   (GAsyncResult *res, GError **error);
 void        mtn_connman_new          (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
@@ -0,0 +1,403 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+/*
+ * Benchmark for the console output: renders the timezone menus, a wifi list,
+ * and the in-place updates of the live wifi list to a pty, both unbuffered,
+ * i.e., a write per output() call as it used to be, and through the output
+ * buffer, and reports the bytes written, the
+ * number of writes (ours, and the syscw from /proc/self/io), and the time the
+ * bytes alone would take on a 115200 baud serial console.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include <glib-object.h>
+
+#include "main.h"
+#include "command.h"
+#include "connman.h"
+#include "timezone.h"
+#include "zonetab.h"
+
+/* 8 data bits, a start and a stop bit */
+#define SERIAL_BYTES_PER_SEC (115200 / 10)
+
+static int       iterations = 5;
+static int       rows = 24;
+static int       cols = 80;
+static int       networks = 40;
+
+static GOptionEntry options[] =
+{
+  {"iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+   "Number of runs of each scene", "N"},
+  {"rows", 'r', 0, G_OPTION_ARG_INT, &rows,
+   "Height of the screen", "N"},
+  {"cols", 'c', 0, G_OPTION_ARG_INT, &cols,
+   "Width of the screen", "N"},
+  {"networks", 'n', 0, G_OPTION_ARG_INT, &networks,
+   "Number of networks in the wifi list", "N"},
+  {NULL}
+};
+
+/*
+ * The menus ask for input; we answer from the queue, flushing the output as
+ * the prompt would.
+ */
+static const char **answers = NULL;
+
+void
+request_input (const char *prompt, GuacaInputFunc cb, gpointer data)
+{
+  output_flush ();
+
+  cb (answers && *answers ? *answers++ : NULL, data);
+}
+
+static void
+get_syscw (guint64 *syscw)
+{
+  FILE *f;
+  char  buf[128];
+
+  *syscw = 0;
+
+  if (!(f = fopen ("/proc/self/io", "r")))
+    return;
+
+  while (fgets (buf, sizeof (buf), f))
+    if (!strncmp (buf, "syscw:", 6))
+      *syscw = g_ascii_strtoull (buf + 6, NULL, 10);
+
+  fclose (f);
+}
+
+static void
+command_done_cb (gboolean success, gpointer data)
+{
+}
+
+/*
+ * The region list, and then the city list of each region in turn; only the
+ * first page of each list is shown, as the user would see it.
+ */
+static void
+render_timezone (void)
+{
+  ZoneTab *zones = zonetab_get ();
+  guint    i;
+
+  for (i = 0; i < zones->n_regions; i++)
+    {
+      char        region[16];
+      const char *menu[3];
+      char        line[] = "timezone";
+
+      snprintf (region, sizeof (region), "%u", i + 1);
+
+      menu[0] = region;
+      menu[1] = "0";
+      menu[2] = NULL;
+      answers = menu;
+
+      command_run (line, command_done_cb, NULL);
+    }
+
+  answers = NULL;
+}
+
+static ConnmanServices *services = NULL;
+
+/*
+ * Builds the table from a GetServices style list, as connman.c does.
+ */
+static void
+make_services (void)
+{
+  static const char *security[] = { "none", "wep", "psk", "ieee8021x" };
+  GVariantBuilder    builder;
+  GVariant          *list;
+  int                i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(oa{sv})"));
+
+  for (i = 0; i < networks; i++)
+    {
+      GVariantBuilder  props;
+      const char      *sec[2];
+      char            *name = g_strdup_printf ("network-%03d", i);
+      char            *path;
+
+      path = g_strdup_printf ("/net/connman/service/wifi_%03d", i);
+
+      sec[0] = security[i % G_N_ELEMENTS (security)];
+      sec[1] = NULL;
+
+      g_variant_builder_init (&props, G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (&props, "{sv}", "Name",
+                             g_variant_new_string (name));
+      g_variant_builder_add (&props, "{sv}", "Type",
+                             g_variant_new_string ("wifi"));
+      g_variant_builder_add (&props, "{sv}", "State",
+                             g_variant_new_string (i ? "idle" : "online"));
+      g_variant_builder_add (&props, "{sv}", "Strength",
+                             g_variant_new_byte (100 - i % 100));
+      g_variant_builder_add (&props, "{sv}", "Security",
+                             g_variant_new_strv (sec, -1));
+
+      g_variant_builder_add (&builder, "(o@a{sv})", path,
+                             g_variant_builder_end (&props));
+
+      g_free (name);
+      g_free (path);
+    }
+
+  list = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  services = connman_services_new ();
+  connman_services_set_all (services, list);
+
+  g_variant_unref (list);
+}
+
+static void
+render_wifi (void)
+{
+  const ConnmanService **top;
+  ConnmanList           *list;
+  guint                  n;
+
+  top  = g_new (const ConnmanService *, MAX (networks, 1));
+  n    = connman_services_top (services, networks, top);
+  list = connman_list_new (top, n);
+
+  output ("wifi> Available networks:\nwifi> \n");
+  connman_list_print (list);
+  output ("wifi> \nwifi> Select wifi [1-%d]:\n", n);
+
+  output_flush ();
+
+  connman_list_free (list);
+  g_free (top);
+}
+
+static ConnmanList *live = NULL;
+static guint        live_round = 0;
+
+/*
+ * A ServicesChanged delta in which the strength of a few of the networks
+ * changes, as it does all the time; each round picks different ones.
+ */
+static void
+change_services (void)
+{
+  GVariantBuilder changed;
+  guint           i;
+
+  g_variant_builder_init (&changed, G_VARIANT_TYPE ("a(oa{sv})"));
+
+  for (i = 0; i < services->services->len; i++)
+    {
+      ConnmanService  *s = g_ptr_array_index (services->services, i);
+      GVariantBuilder  props;
+
+      g_variant_builder_init (&props, G_VARIANT_TYPE ("a{sv}"));
+
+      if ((i + live_round) % 8 == 0)
+        g_variant_builder_add (&props, "{sv}", "Strength",
+                               g_variant_new_byte (s->strength ^ 1));
+
+      g_variant_builder_add (&changed, "(o@a{sv})", s->path,
+                             g_variant_builder_end (&props));
+    }
+
+  connman_services_apply (services,
+                          g_variant_builder_end (&changed),
+                          g_variant_new_array (G_VARIANT_TYPE_OBJECT_PATH,
+                                               NULL, 0));
+  live_round++;
+}
+
+/*
+ * The list as shown at the prompt, updated in place after a change; the
+ * unbuffered run is the same, as the update is written in one go anyway.
+ */
+static void
+render_wifi_live (void)
+{
+  if (!live)
+    {
+      const ConnmanService **top;
+      guint                  n;
+
+      top  = g_new (const ConnmanService *, MAX (networks, 1));
+      n    = connman_services_top (services, networks, top);
+      live = connman_list_new (top, n);
+
+      g_free (top);
+    }
+
+  change_services ();
+  connman_list_update (live, services, 2);
+
+  output_flush ();
+}
+
+static void
+run_scene (const char *name, void (*render) (void))
+{
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      gboolean buffered = i;
+      guint64  bytes0, writes0, syscw0;
+      guint64  bytes, writes, syscw;
+      gint64   start, end;
+      int      j;
+
+      output_set_buffered (buffered);
+
+      output_get_stats (&bytes0, &writes0);
+      get_syscw (&syscw0);
+      start = g_get_monotonic_time ();
+
+      for (j = 0; j < iterations; j++)
+        render ();
+
+      end = g_get_monotonic_time ();
+      get_syscw (&syscw);
+      output_get_stats (&bytes, &writes);
+
+      bytes  = (bytes - bytes0) / iterations;
+      writes = (writes - writes0) / iterations;
+      syscw  = (syscw - syscw0) / iterations;
+
+      printf ("  %-10s %-10s %10" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+              " %8" G_GUINT64_FORMAT " %10.3f %10.0f\n",
+              name, buffered ? "buffered" : "unbuffered",
+              bytes, writes, syscw,
+              (end - start) / 1000.0 / iterations,
+              bytes * 1000.0 / SERIAL_BYTES_PER_SEC);
+    }
+}
+
+/*
+ * Opens a pty, with a child draining the master side, and returns the slave
+ * side for the output.
+ */
+static FILE *
+open_pty (pid_t *child)
+{
+  int   master, slave;
+  char *name;
+
+  if ((master = posix_openpt (O_RDWR | O_NOCTTY)) < 0 ||
+      grantpt (master) < 0 || unlockpt (master) < 0 ||
+      !(name = ptsname (master)))
+    {
+      fprintf (stderr, "Failed to open pty: %s\n", strerror (errno));
+      return NULL;
+    }
+
+  if ((slave = open (name, O_RDWR | O_NOCTTY)) < 0)
+    {
+      fprintf (stderr, "Failed to open %s: %s\n", name, strerror (errno));
+      return NULL;
+    }
+
+  if (!(*child = fork ()))
+    {
+      char buf[4096];
+
+      close (slave);
+
+      while (read (master, buf, sizeof (buf)) > 0);
+
+      _exit (0);
+    }
+
+  close (master);
+
+  return fdopen (slave, "w");
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError         *error = NULL;
+  FILE           *pty;
+  pid_t           child;
+
+  context = g_option_context_new ("- benchmark the console output");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  iterations = MAX (iterations, 1);
+
+  g_type_init ();
+
+  timezone_register ();
+  make_services ();
+
+  if (!(pty = open_pty (&child)))
+    return 1;
+
+  output_set_stream (pty);
+  output_set_screen_size (rows, cols);
+  output_set_cursor_addressing (TRUE);
+
+  printf ("  %-10s %-10s %10s %8s %8s %10s %10s\n",
+          "scene", "output", "bytes", "writes", "syscw", "ms", "serial ms");
+
+  run_scene ("timezone", render_timezone);
+  run_scene ("wifi", render_wifi);
+  run_scene ("wifi-live", render_wifi_live);
+
+  output_set_stream (NULL);
+  fclose (pty);
+
+  kill (child, SIGTERM);
+  waitpid (child, NULL, 0);
+
+  connman_list_free (live);
+  connman_services_free (services);
+
+  return 0;
+}
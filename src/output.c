@@ -0,0 +1,352 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <glib.h>
+
+#include "output.h"
+
+/*
+ * The output is collected in a buffer and written out in one go, a screen at
+ * a time; on a serial console every write costs, and the menus are made of
+ * many short lines. Whatever is left in the buffer is flushed once the main
+ * loop goes idle, and explicitly before we prompt or read.
+ */
+#define OUTPUT_BUFFER_SIZE 16384
+
+static FILE     *out_stream = NULL;
+static GString  *out_buf = NULL;
+static int       out_rows = 24;
+static int       out_cols = 80;
+static int       out_lines = 0;
+static gboolean  out_buffered = TRUE;
+static guint     out_idle_id = 0;
+static GString  *out_capture = NULL;
+
+static GuacaOutputFunc out_redirect = NULL;
+static gpointer        out_redirect_data = NULL;
+
+static guint64   out_bytes = 0;
+static guint64   out_writes = 0;
+
+static gboolean  out_addressing = FALSE;
+
+static void
+write_buf (void)
+{
+  FILE  *stream = out_stream ? out_stream : stdout;
+  int    fd = fileno (stream);
+  gsize  done = 0;
+
+  if (out_redirect)
+    {
+      out_redirect (out_buf->str, out_buf->len, out_redirect_data);
+
+      out_writes++;
+      out_bytes += out_buf->len;
+
+      g_string_truncate (out_buf, 0);
+      out_lines = 0;
+      return;
+    }
+
+  /* anything readline left in the stream goes first */
+  fflush (stream);
+
+  while (done < out_buf->len)
+    {
+      ssize_t n = write (fd, out_buf->str + done, out_buf->len - done);
+
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          break;
+        }
+
+      out_writes++;
+      done += n;
+    }
+
+  out_bytes += done;
+
+  g_string_truncate (out_buf, 0);
+  out_lines = 0;
+}
+
+void
+output_flush (void)
+{
+  if (out_idle_id)
+    {
+      g_source_remove (out_idle_id);
+      out_idle_id = 0;
+    }
+
+  if (out_buf && out_buf->len)
+    write_buf ();
+}
+
+static gboolean
+flush_idle_cb (gpointer data)
+{
+  out_idle_id = 0;
+  output_flush ();
+
+  return FALSE;
+}
+
+/*
+ * Accounts for the text appended to the buffer from start on, and flushes as
+ * needed.
+ */
+static void
+appended (gsize start)
+{
+  const char *p   = out_buf->str + start;
+  const char *end = out_buf->str + out_buf->len;
+
+  while ((p = memchr (p, '\n', end - p)))
+    {
+      out_lines++;
+      p++;
+    }
+
+  /* a line is left for the prompt */
+  if (!out_buffered || out_lines >= out_rows - 1 ||
+      out_buf->len >= OUTPUT_BUFFER_SIZE)
+    output_flush ();
+  else if (!out_idle_id)
+    out_idle_id = g_idle_add (flush_idle_cb, NULL);
+}
+
+void
+output (const char *fmt, ...)
+{
+  va_list args;
+  gsize   start;
+
+  if (out_capture)
+    {
+      va_start (args, fmt);
+      g_string_append_vprintf (out_capture, fmt, args);
+      va_end (args);
+      return;
+    }
+
+  if (!out_buf)
+    out_buf = g_string_sized_new (OUTPUT_BUFFER_SIZE);
+
+  start = out_buf->len;
+
+  va_start (args, fmt);
+  g_string_append_vprintf (out_buf, fmt, args);
+  va_end (args);
+
+  appended (start);
+}
+
+/*
+ * Writes the text as is, bypassing any capture; this is how the JSON writer
+ * gets its output out while the text of the command is captured.
+ */
+void
+output_write (const char *str, gsize len)
+{
+  gsize start;
+
+  if (!out_buf)
+    out_buf = g_string_sized_new (OUTPUT_BUFFER_SIZE);
+
+  start = out_buf->len;
+  g_string_append_len (out_buf, str, len);
+
+  appended (start);
+}
+
+/*
+ * While capture is set, the output() text is appended to it instead of being
+ * written out; pass NULL to stop.
+ */
+void
+output_set_capture (GString *capture)
+{
+  out_capture = capture;
+}
+
+/*
+ * Sets the stream to write to, stdout by default.
+ */
+void
+output_set_stream (FILE *stream)
+{
+  output_flush ();
+  out_stream = stream;
+}
+
+/*
+ * While set, whatever is flushed is handed to func instead of being written to
+ * the stream; pass NULL to stop.
+ */
+void
+output_set_redirect (GuacaOutputFunc func, gpointer data)
+{
+  output_flush ();
+
+  out_redirect      = func;
+  out_redirect_data = data;
+}
+
+/*
+ * Sets the screen size; the buffer is flushed whenever it holds a screenful.
+ */
+void
+output_set_screen_size (int rows, int cols)
+{
+  out_rows = MAX (rows, 2);
+  out_cols = MAX (cols, 1);
+}
+
+void
+output_get_screen_size (int *rows, int *cols)
+{
+  if (rows)
+    *rows = out_rows;
+
+  if (cols)
+    *cols = out_cols;
+}
+
+/*
+ * Unbuffered, every call to output() results in a write.
+ */
+void
+output_set_buffered (gboolean buffered)
+{
+  out_buffered = buffered;
+
+  if (!buffered)
+    output_flush ();
+}
+
+void
+output_get_stats (guint64 *bytes, guint64 *writes)
+{
+  if (bytes)
+    *bytes = out_bytes;
+
+  if (writes)
+    *writes = out_writes;
+}
+
+/*
+ * Whether we can move the cursor around the screen, i.e., the output goes to
+ * a terminal; this is what output_update_line() needs.
+ */
+void
+output_set_cursor_addressing (gboolean addressing)
+{
+  out_addressing = addressing;
+}
+
+gboolean
+output_has_cursor_addressing (void)
+{
+  return out_addressing;
+}
+
+/*
+ * Rewrites the line up lines above the cursor, showing old, to show new, and
+ * puts the cursor back where it was; only the part of the line that differs
+ * is written. Neither line may contain a newline. Returns FALSE if the line
+ * cannot be updated, i.e., we have no cursor addressing, or it has scrolled
+ * off the screen.
+ */
+gboolean
+output_update_line (int up, const char *old, const char *new)
+{
+  gsize    old_len = strlen (old);
+  gsize    new_len = strlen (new);
+  glong    old_chars, new_chars;
+  gsize    start = 0;
+  gsize    end = new_len;
+  glong    col;
+  GString *seq;
+
+  if (!out_addressing || up < 0 || up >= out_rows)
+    return FALSE;
+
+  while (start < old_len && start < new_len && old[start] == new[start])
+    start++;
+
+  if (start == old_len && start == new_len)
+    return TRUE;
+
+  /* do not split a character */
+  while (start > 0 && (new[start] & 0xc0) == 0x80)
+    start--;
+
+  old_chars = g_utf8_strlen (old, -1);
+  new_chars = g_utf8_strlen (new, -1);
+
+  /*
+   * If both are the same width, the tail they share can stay; otherwise
+   * everything from the first difference is written, and what is left of a
+   * longer old line erased.
+   */
+  if (old_len == new_len && old_chars == new_chars)
+    {
+      while (end > start && old[end - 1] == new[end - 1])
+        end--;
+
+      while (end < new_len && (new[end] & 0xc0) == 0x80)
+        end++;
+    }
+
+  col = g_utf8_strlen (new, start);
+  seq = g_string_sized_new (32);
+
+  /* save the cursor, and restore it when done */
+  g_string_append (seq, "\0337");
+
+  if (up)
+    g_string_append_printf (seq, "\033[%dA", up);
+
+  if (col)
+    g_string_append_printf (seq, "\033[%ldG", col + 1);
+  else
+    g_string_append_c (seq, '\r');
+
+  g_string_append_len (seq, new + start, end - start);
+
+  if (new_chars < old_chars)
+    g_string_append (seq, "\033[K");
+
+  g_string_append (seq, "\0338");
+
+  output_write (seq->str, seq->len);
+  g_string_free (seq, TRUE);
+
+  return TRUE;
+}
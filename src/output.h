@@ -0,0 +1,42 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_OUTPUT_H
+#define GUACA_OUTPUT_H
+
+#include <stdio.h>
+#include <glib.h>
+
+typedef void (*GuacaOutputFunc) (const char *str, gsize len, gpointer data);
+
+void output                 (const char *fmt, ...) G_GNUC_PRINTF (1, 2);
+void output_write           (const char *str, gsize len);
+void output_flush           (void);
+void output_set_capture     (GString *capture);
+void output_set_stream      (FILE *stream);
+void output_set_redirect    (GuacaOutputFunc func, gpointer data);
+void output_set_screen_size (int rows, int cols);
+void output_get_screen_size (int *rows, int *cols);
+void output_set_buffered    (gboolean buffered);
+void output_get_stats       (guint64 *bytes, guint64 *writes);
+
+void     output_set_cursor_addressing (gboolean addressing);
+gboolean output_has_cursor_addressing (void);
+gboolean output_update_line           (int         up,
+                                       const char *old,
+                                       const char *new);
+
+#endif
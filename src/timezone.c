@@ -28,282 +28,557 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
-#include <readline/readline.h>
+#include <time.h>
 
 #include "main.h"
 #include "timezone.h"
+#include "command.h"
+#include "zonetab.h"
+#include "tzfile.h"
+#include "menu.h"
+#include "json.h"
 
 #define PROMPT "timezone> "
 
-typedef struct TzEntry
-{
-  char       *country;
-  char       *zone;
-  char       *region;
-  char       *city;
-} TzEntry;
-
-static TzEntry *
-tz_entry_new (const char *country, const char *zone)
-{
-  TzEntry     *t;
-  char        *p, *region, *path;
-  struct stat  st;
+/* number of zones listed by 'timezone near' */
+#define NEAR_COUNT 5
 
-  /*
-   * Make sure we have the actual zone info here, since Poky prunes the data
-   * without prooning the zones.tab
-   */
-  path = g_build_filename ("/usr/share/zoneinfo", zone, NULL);
+/*
+ * Formats the current offset of the zone as ' (UTC+01:00 BST, DST)', or an
+ * empty string if the zone file cannot be read.
+ */
+static void
+format_offset (const char *zone, gint64 now, char *buf, gsize len)
+{
+  TzOffset off;
+  guint    secs;
 
-  if (stat (path, &st) < 0)
+  if (!tzfile_get_offset (zone, now, &off))
     {
-      g_free (path);
-      return NULL;
+      *buf = 0;
+      return;
     }
 
-  g_free (path);
-
-  t = g_slice_new0 (TzEntry);
+  secs = ABS (off.utoff);
 
-  t->country = g_strdup (country);
-  t->zone    = g_strdup (zone);
+  g_snprintf (buf, len, " (UTC%c%02u:%02u %s%s)",
+              off.utoff < 0 ? '-' : '+', secs / 3600, secs / 60 % 60,
+              off.abbrev, off.is_dst ? ", DST" : "");
+}
 
-  region = g_strdup (zone);
+/*
+ * Describes the zone as a JSON object; the object is left open for the caller
+ * to add to and close.
+ */
+static void
+json_zone (const ZoneTab *zones, const ZoneEntry *e, gint64 now)
+{
+  TzOffset off;
 
-  /* replace underscores with spaces */
-  for (p = region; *p; p++)
-    if (*p == '_')
-      *p = ' ';
+  json_begin_object (NULL);
+  json_string ("zone", ZONE_STR (zones, e->zone));
+  json_string ("region", ZONE_STR (zones, e->region));
+  json_string ("city", ZONE_STR (zones, e->city));
+  json_string ("country", ZONE_STR (zones, e->country));
+  json_string ("country_name", ZONE_STR (zones, e->country_name));
 
-  if ((p = strchr (region, '/')))
+  if (tzfile_get_offset (ZONE_STR (zones, e->zone), now, &off))
     {
-      *p = 0;
-      t->city = g_strdup (p+1);
+      json_int ("utc_offset", off.utoff);
+      json_string ("abbrev", off.abbrev);
+      json_bool ("dst", off.is_dst);
     }
-
-  t->region = g_strdup (region);
-
-  g_free (region);
-
-  return t;
 }
 
-static void
-tz_entry_free (TzEntry *t)
-{
-  g_free (t->country);
-  g_free (t->zone);
-  g_free (t->region);
-  g_free (t->city);
+/*
+ * The timezone is switched by preparing the new /etc/timezone and
+ * /etc/localtime under temporary names, and then renaming them over the old
+ * ones, so that at no point either of them is missing or partially written.
+ *
+ * The contents of the new timezone file must be on disk before the rename is,
+ * else we could end up with an empty file after a crash; the symlink needs no
+ * such flush, since it is created along with its directory entry. All the
+ * directory changes are then made durable by a single fsync of /etc.
+ */
+#define TIMEZONE_TMP  "timezone.guaca-tmp"
+#define LOCALTIME_TMP "localtime.guaca-tmp"
 
-  g_slice_free (TzEntry, t);
-}
+static const char *etc_dir = "/etc";
 
-static int
-tz_entry_cmp (TzEntry *e1, TzEntry *e2)
+/*
+ * Redirects the writes to /etc elsewhere; only meant for the benchmark.
+ */
+void
+timezone_set_etc_dir (const char *dir)
 {
-  return g_strcmp0 (e1->zone, e2->zone);
+  etc_dir = dir;
 }
 
-static GHashTable *
-get_zones (void)
+static gboolean
+write_all (int fd, const char *data, gsize len)
 {
-  FILE  *f;
-  char   buf[512];
-  GList *regions;
-  GList *l;
+  while (len)
+    {
+      ssize_t n = write (fd, data, len);
 
-  static GHashTable *regions_tbl = NULL;
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        return FALSE;
 
-  if (regions_tbl)
-    return regions_tbl;
+      data += n;
+      len  -= n;
+    }
 
-  regions_tbl = g_hash_table_new (g_str_hash, g_str_equal);
+  return TRUE;
+}
+
+/*
+ * With the tzdata bundle there is no zone file to link to, so the zone data
+ * are copied into a regular /etc/localtime; the same flush rules as for the
+ * timezone file apply.
+ */
+static gboolean
+write_localtime (int dfd, const char *zone)
+{
+  gconstpointer data;
+  gsize         len;
+  gboolean      retval;
+  int           fd;
 
-  if (!(f = fopen ("/usr/share/zoneinfo/zone.tab", "r")))
+  if (!(data = zonetab_map_file (zone, &len)))
     {
-      g_warning ("Failed to open zone.tab: %s", strerror (errno));
+      output ("Failed to find '%s'\n", zone);
       return FALSE;
     }
 
-  while (fgets (buf, sizeof (buf), f))
+  if ((fd = openat (dfd, LOCALTIME_TMP,
+                    O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0)
     {
-      char    *code, *coords, *zone;
-      TzEntry *e;
-
-      if (buf[0] == '#')
-        continue;
-
-      buf[sizeof (buf)-1] = 0;
-
-      if (! (code = strtok (buf, "\t\n")))
-        continue;
-      if (! (coords = strtok (NULL, "\t\n")))
-        continue;
-      if (! (zone = strtok (NULL, "\t\n")))
-        continue;
-
-      /*
-       * Push this into a hash table keyed by region (the MxComboBox is too
-       * inefficient to manage big lists, and it would be user unfriendly anyway
-       */
-      if (!(e = tz_entry_new (code, zone)))
-        continue;
-
-      l = g_hash_table_lookup (regions_tbl, e->region);
-      l = g_list_prepend (l, e);
-      g_hash_table_insert (regions_tbl, e->region, l);
+      output ("Failed to create local time: %s\n", strerror (errno));
+      zonetab_unmap_file (data, len);
+      return FALSE;
     }
 
-  fclose (f);
-
-  /*
-   * Now sort out the individual sublists
-   */
-  regions = g_hash_table_get_values (regions_tbl);
-  for (l = regions; l; l = l->next)
-    {
-      GList   *k = l->data;
-      TzEntry *e = k->data;
+  if (!(retval = write_all (fd, data, len) && !fdatasync (fd)))
+    output ("Failed to write local time: %s\n", strerror (errno));
 
-      k = g_list_sort (k, (GCompareFunc)tz_entry_cmp);
-      g_hash_table_insert (regions_tbl, e->region, k);
-    }
-  g_list_free (regions);
+  close (fd);
+  zonetab_unmap_file (data, len);
 
-  return regions_tbl;
+  return retval;
 }
 
 static gboolean
 write_timezone (const char *zone)
 {
-  gboolean    retval = TRUE;
-  char       *p;
+  gboolean    retval = FALSE;
+  gboolean    bundle = zonetab_has_bundle ();
   char       *path = NULL;
-  FILE       *f = NULL;
+  int         dfd = -1;
+  int         fd = -1;
   struct stat st;
 
-  path = g_build_filename ("/usr/share/zoneinfo", zone, NULL);
+  path = g_build_filename (zonetab_get_root (), zone, NULL);
 
-  if (stat (path, &st) < 0)
+  if (!bundle && stat (path, &st) < 0)
     {
       output ("Failed to stat '%s': %s\n", zone, strerror (errno));
-      retval = FALSE;
       goto finish;
     }
 
-  if ((f = fopen ("/etc/timezone", "w")))
+  if ((dfd = open (etc_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
     {
-      fputs (zone, f);
+      output ("Failed to open %s: %s\n", etc_dir, strerror (errno));
+      goto finish;
     }
-  else
+
+  if ((fd = openat (dfd, TIMEZONE_TMP,
+                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
     {
       output ("Failed to open /etc/timezone: %s\n", strerror (errno));
-      retval = FALSE;
       goto finish;
     }
 
-  if (unlink ("/etc/localtime"))
+  if (!write_all (fd, zone, strlen (zone)) || fdatasync (fd))
     {
-      output ("Failed to unlink localtime: %s\n", strerror (errno));
-      retval = FALSE;
-      goto finish;
+      output ("Failed to write /etc/timezone: %s\n", strerror (errno));
+      goto cleanup;
     }
 
+  /* in case a previous attempt left it behind */
+  unlinkat (dfd, LOCALTIME_TMP, 0);
 
-  if (symlink (path, "/etc/localtime"))
+  if (bundle)
+    {
+      if (!write_localtime (dfd, zone))
+        goto cleanup;
+    }
+  else if (symlinkat (path, dfd, LOCALTIME_TMP))
     {
       output ("Failed to symlink local time: %s\n", strerror (errno));
-      retval = FALSE;
-      goto finish;
+      goto cleanup;
     }
 
+  if (renameat (dfd, TIMEZONE_TMP, dfd, "timezone"))
+    {
+      output ("Failed to replace /etc/timezone: %s\n", strerror (errno));
+      goto cleanup;
+    }
+
+  if (renameat (dfd, LOCALTIME_TMP, dfd, "localtime"))
+    {
+      output ("Failed to replace /etc/localtime: %s\n", strerror (errno));
+      goto cleanup;
+    }
+
+  if (fsync (dfd))
+    g_warning ("Failed to sync /etc: %s", strerror (errno));
+
+  json_string ("timezone", zone);
+  retval = TRUE;
+  goto finish;
+
+ cleanup:
+  unlinkat (dfd, TIMEZONE_TMP, 0);
+  unlinkat (dfd, LOCALTIME_TMP, 0);
+
  finish:
-  if (f)
-    fclose (f);
+  if (fd >= 0)
+    close (fd);
+
+  if (dfd >= 0)
+    close (dfd);
 
   g_free (path);
 
   return retval;
 }
 
-gboolean
-set_timezone (char *line)
+/*
+ * Non-interactive path for 'timezone <zone>'; the zone can be given as any
+ * unique prefix of the zone name, and spaces can be used instead of
+ * underscores.
+ */
+static gboolean
+set_timezone_direct (const ZoneTab *zones, char *zone)
 {
-  gboolean retval = TRUE;
-  GHashTable *regions_tbl;
-  GList      *keys, *l, *r;
-  int         i;
-  char       *sel = NULL;
-  const char *key;
-  TzEntry    *e;
-
-  regions_tbl = get_zones ();
-  keys = g_hash_table_get_keys (regions_tbl);
-  keys = g_list_sort (keys, (GCompareFunc)g_strcmp0);
-
-  for (i = 1, l = keys; l; l = l->next, i++)
+  const ZoneEntry *e;
+  char            *p;
+  guint            first, n, i;
+
+  for (p = zone; *p; p++)
+    if (*p == ' ')
+      *p = '_';
+
+  if ((e = zonetab_find (zones, zone)))
+    return write_timezone (ZONE_STR (zones, e->zone));
+
+  n = zonetab_find_prefix (zones, zone, &first);
+
+  if (n == 1)
+    return write_timezone (ZONE_STR (zones, zones->entries[first].zone));
+
+  if (!n)
     {
-      const char *region = l->data;
+      output ("Unknown timezone '%s'\n", zone);
+      return FALSE;
+    }
+
+  output ("Ambiguous timezone '%s', could be:\n", zone);
+
+  for (i = first; i < first + n && i < first + 10; i++)
+    output ("    %s\n", ZONE_STR (zones, zones->entries[i].zone));
+
+  json_begin_array ("candidates");
+
+  for (i = first; i < first + n; i++)
+    json_string (NULL, ZONE_STR (zones, zones->entries[i].zone));
+
+  json_end_array ();
+
+  if (n > 10)
+    output ("    ... (%u more)\n", n - 10);
+
+  return FALSE;
+}
+
+/*
+ * 'timezone near <lat> <lon>' lists the zones closest to the given location
+ */
+static gboolean
+set_timezone_near (char *args)
+{
+  ZoneTab *zones = zonetab_get ();
+  double  lat, lon;
+  double  dist[NEAR_COUNT];
+  guint   found[NEAR_COUNT];
+  char    offset[64];
+  char   *p, *q, *end;
+  guint   i, n;
+  gint64  now;
 
-      output (PROMPT "    %d: %s\n", i, region);
+  lat = g_ascii_strtod (args, &end);
+
+  for (q = end; *q == ',' || isspace ((guchar) *q); q++);
+
+  lon = g_ascii_strtod (q, &p);
+
+  if (end == args || p == q || *g_strstrip (p) ||
+      lat < -90.0 || lat > 90.0 || lon < -180.0 || lon > 180.0)
+    {
+      output ("Usage: timezone near <latitude> <longitude>\n");
+      return FALSE;
     }
 
-  output (PROMPT "\n" PROMPT "Select regions [1-%d]\n", i-1);
+  n = zonetab_find_nearest (zones, lat, lon, NEAR_COUNT, found, dist);
+  now = time (NULL);
 
-  if (!(sel = readline (PROMPT "? ")))
+  if (json_is_enabled ())
     {
-      retval = TRUE;
-      goto finish;
+      json_begin_array ("zones");
+
+      for (i = 0; i < n; i++)
+        {
+          json_zone (zones, &zones->entries[found[i]], now);
+          json_double ("distance", dist[i]);
+          json_end_object ();
+        }
+
+      json_end_array ();
+
+      return n > 0;
     }
 
-  if (!(i = strtol (sel, NULL, 10)))
+  for (i = 0; i < n; i++)
     {
-      retval = FALSE;
-      goto finish;
+      const ZoneEntry *e = &zones->entries[found[i]];
+
+      format_offset (ZONE_STR (zones, e->zone), now, offset, sizeof (offset));
+
+      output ("    %d: %s (%s), %.0f km%s\n", i+1, ZONE_STR (zones, e->zone),
+              ZONE_STR (zones, e->country_name), dist[i], offset);
     }
 
-  key = g_list_nth_data (keys, i-1);
+  return n > 0;
+}
+
+/*
+ * Readline generator for zone names; the indices are into the table we
+ * started with, so we hold on to it until the run is over, in case a refresh
+ * replaces it between the calls.
+ */
+char *
+timezone_complete (const char *text, int state)
+{
+  static ZoneTab *zones = NULL;
+  static guint    i = 0;
+  static guint    last = 0;
 
-  if (!(r = g_hash_table_lookup (regions_tbl, key)))
+  if (!state)
     {
-      retval = FALSE;
-      goto finish;
+      guint n;
+
+      zonetab_unref (zones);
+      zones = zonetab_ref (zonetab_get ());
+
+      n = zonetab_find_prefix (zones, text, &i);
+      last = i + n;
     }
 
-  for (i = 1, l = r; l; l = l->next, i++)
+  if (zones && i < last)
+    return strdup (ZONE_STR (zones, zones->entries[i++].zone));
+
+  zonetab_unref (zones);
+  zones = NULL;
+
+  return NULL;
+}
+
+/*
+ * The interactive selection; we hold on to the table while the user picks, so
+ * a refresh in the meantime does not pull it from under us. Long lists are
+ * shown a page at a time, an empty answer shows the next page.
+ */
+typedef struct
+{
+  ZoneTab          *zones;
+  const ZoneRegion *region;
+  GuacaMenu        *menu;
+} TzMenu;
+
+static void select_region_cb (const char *sel, gpointer data);
+static void select_city_cb (const char *sel, gpointer data);
+
+static void
+tz_menu_done (TzMenu *menu, gboolean success)
+{
+  menu_free (menu->menu);
+  zonetab_unref (menu->zones);
+  g_slice_free (TzMenu, menu);
+
+  command_done (success);
+}
+
+/*
+ * Shows the next page of the current list, and asks for the selection.
+ */
+static void
+tz_menu_ask (TzMenu *menu)
+{
+  const char *what = menu->region ? "city" : "regions";
+
+  menu_show_page (menu->menu);
+
+  output (PROMPT "\n" PROMPT "Select %s [1-%u]%s\n", what,
+          menu_get_length (menu->menu),
+          menu_has_more (menu->menu) ? ", Enter for more" : "");
+
+  request_input (PROMPT "? ",
+                 menu->region ? select_city_cb : select_region_cb, menu);
+}
+
+static void
+select_city_cb (const char *sel, gpointer data)
+{
+  TzMenu           *menu = data;
+  ZoneTab          *zones = menu->zones;
+  const ZoneRegion *r = menu->region;
+  const ZoneEntry  *e;
+  guint             i;
+
+  if (sel && !*sel && menu_has_more (menu->menu))
     {
-      e = l->data;
+      tz_menu_ask (menu);
+      return;
+    }
 
-      output (PROMPT "    %d: %s, %s\n", i, e->country, e->city);
+  if (!sel || !(i = strtol (sel, NULL, 10)))
+    {
+      tz_menu_done (menu, TRUE);
+      return;
     }
 
-  output (PROMPT "\n" PROMPT "Select city [1-%d]\n", i-1);
+  if (i > r->n_entries)
+    {
+      tz_menu_done (menu, FALSE);
+      return;
+    }
 
-  free (sel);
+  e = &zones->entries[r->first + i - 1];
 
-  if (!(sel = readline (PROMPT "? ")))
+  tz_menu_done (menu, write_timezone (ZONE_STR (zones, e->zone)));
+}
+
+static void
+select_region_cb (const char *sel, gpointer data)
+{
+  TzMenu           *menu = data;
+  ZoneTab          *zones = menu->zones;
+  const ZoneRegion *r;
+  const ZoneEntry  *e;
+  guint             i;
+  char              offset[64];
+  gint64            now;
+
+  if (sel && !*sel && menu_has_more (menu->menu))
     {
-      retval = TRUE;
-      goto finish;
+      tz_menu_ask (menu);
+      return;
     }
 
-  if (!(i = strtol (sel, NULL, 10)))
+  if (!sel)
     {
-      retval = TRUE;
-      goto finish;
+      tz_menu_done (menu, TRUE);
+      return;
     }
 
-  e = g_list_nth_data (r, i-1);
+  i = strtol (sel, NULL, 10);
 
-  retval = write_timezone (e->zone);
+  if (i < 1 || i > zones->n_regions)
+    {
+      tz_menu_done (menu, FALSE);
+      return;
+    }
 
- finish:
-  if (sel)
-    free (sel);
+  r = menu->region = &zones->regions[i-1];
+  now = time (NULL);
 
-  g_list_free (keys);
+  menu_free (menu->menu);
+  menu->menu = menu_new (PROMPT);
 
-  return retval;
+  for (i = 0; i < r->n_entries; i++)
+    {
+      e = &zones->entries[r->first + i];
+
+      format_offset (ZONE_STR (zones, e->zone), now, offset, sizeof (offset));
+
+      menu_add (menu->menu, "%s (%s)%s", ZONE_STR (zones, e->city),
+                ZONE_STR (zones, e->country_name), offset);
+    }
+
+  tz_menu_ask (menu);
+}
+
+gboolean
+set_timezone (char *args)
+{
+  ZoneTab *zones;
+  TzMenu  *menu;
+  guint    i;
+
+  zones = zonetab_get ();
+
+  if (*args)
+    return set_timezone_direct (zones, g_strstrip (args));
+
+  /* there is no one to pick from the menus, so just list the zones */
+  if (json_is_enabled ())
+    {
+      gint64 now = time (NULL);
+
+      json_begin_array ("zones");
+
+      for (i = 0; i < zones->n_entries; i++)
+        {
+          json_zone (zones, &zones->entries[i], now);
+          json_end_object ();
+        }
+
+      json_end_array ();
+
+      return TRUE;
+    }
+
+  menu = g_slice_new0 (TzMenu);
+  menu->zones = zonetab_ref (zones);
+  menu->menu  = menu_new (PROMPT);
+
+  for (i = 0; i < zones->n_regions; i++)
+    menu_add (menu->menu, "%s", ZONE_STR (zones, zones->regions[i].name));
+
+  command_defer (NULL, NULL);
+  tz_menu_ask (menu);
+
+  return TRUE;
+}
+
+static const GuacaCmd cmds[] =
+{
+  {"timezone", "[zone]", "Set timezone", set_timezone, C_NONE,
+   timezone_complete},
+};
+
+static const GuacaCmd timezone_cmds[] =
+{
+  {"near", "<lat> <lon>", "List zones nearest to location", set_timezone_near,
+   C_NONE},
+};
+
+void
+timezone_register (void)
+{
+  command_register (NULL, cmds, G_N_ELEMENTS (cmds));
+  command_register ("timezone", timezone_cmds, G_N_ELEMENTS (timezone_cmds));
 }
@@ -17,6 +17,9 @@
 #ifndef GUACA_TIMEZONE_H
 #define GUACA_TIMEZONE_H
 
-gboolean set_timezone (char *line);
+void     timezone_register    (void);
+gboolean set_timezone         (char *args);
+char    *timezone_complete    (const char *text, int state);
+void     timezone_set_etc_dir (const char *dir);
 
 #endif
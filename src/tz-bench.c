@@ -0,0 +1,617 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+/*
+ * Benchmark for the timezone code: loading of the zone table, lookups, zone
+ * offsets, and applying a zone, against either an existing zoneinfo tree or
+ * tzdata bundle, or synthetic trees with zone.tab files of the given sizes.
+ *
+ * For each phase we report the wall time, the number of syscalls and heap
+ * allocations, and the heap held at the end of the phase. Each tree is
+ * benchmarked in a child process, so that the peak RSS reported is for that
+ * tree alone; the parent traces the child's syscalls, but only while a phase
+ * is being counted, since tracing slows the syscalls down a lot. The timed
+ * runs are separate from the counted one.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <signal.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include <glib-object.h>
+
+#include "main.h"
+#include "timezone.h"
+#include "zonetab.h"
+#include "tzfile.h"
+
+/* zone file used for all the synthetic zones */
+#define TEMPLATE_ZONE "Europe/London"
+
+typedef struct
+{
+  char    *root;
+  char    *etc;
+  char    *cache;
+  ZoneTab *tab;
+  char    *apply;
+} BenchState;
+
+typedef void (*BenchFunc) (BenchState *state);
+
+static int       iterations = 5;
+static gboolean  keep = FALSE;
+static char     *root = NULL;
+static char     *bundle = NULL;
+static char    **sizes = NULL;
+
+static GOptionEntry options[] =
+{
+  {"root", 'r', 0, G_OPTION_ARG_FILENAME, &root,
+   "Benchmark an existing zoneinfo tree", "DIR"},
+  {"bundle", 'b', 0, G_OPTION_ARG_FILENAME, &bundle,
+   "Benchmark a tzdata bundle", "FILE"},
+  {"lines", 'n', 0, G_OPTION_ARG_STRING_ARRAY, &sizes,
+   "Size of the synthetic zone.tab (can be repeated)", "N"},
+  {"iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+   "Number of runs of each phase", "N"},
+  {"keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+   "Do not remove the generated trees", NULL},
+  {NULL}
+};
+
+/* syscalls made by the child, counted by the parent while tracing it */
+static volatile guint64 *n_syscalls = NULL;
+static gboolean          traced = FALSE;
+
+/* calls to the allocator */
+static guint64 n_allocs = 0;
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+void *
+malloc (size_t size)
+{
+  n_allocs++;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+  n_allocs++;
+  return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  n_allocs++;
+  return __libc_realloc (ptr, size);
+}
+
+/*
+ * The timezone code never prompts for the zones we apply.
+ */
+void
+request_input (const char *prompt, GuacaInputFunc cb, gpointer data)
+{
+  cb (NULL, data);
+}
+
+/*
+ * The parent switches the syscall tracing on and off when it sees these
+ * signals; raise() makes a few syscalls of its own, which run_phase() takes
+ * off.
+ */
+static void
+count_start (void)
+{
+  raise (SIGUSR1);
+}
+
+static void
+count_stop (void)
+{
+  raise (SIGUSR2);
+}
+
+static gsize
+get_heap (void)
+{
+#ifdef HAVE_MALLINFO2
+  return mallinfo2 ().uordblks;
+#else
+  return (guint) mallinfo ().uordblks;
+#endif
+}
+
+static void
+run_phase (const char *name,
+           BenchFunc   setup,
+           BenchFunc   func,
+           BenchFunc   teardown,
+           BenchState *state)
+{
+  static guint64 overhead = G_MAXUINT64;
+  gint64         t, t_min = G_MAXINT64, t_total = 0;
+  guint64        s0, a0, syscalls, allocs;
+  gssize         heap;
+  gsize          h;
+  char           count[24];
+  int            i;
+
+  if (overhead == G_MAXUINT64)
+    {
+      s0 = *n_syscalls;
+      count_start ();
+      count_stop ();
+      overhead = *n_syscalls - s0;
+    }
+
+  for (i = 0; i < iterations; i++)
+    {
+      if (setup)
+        setup (state);
+
+      t = g_get_monotonic_time ();
+
+      func (state);
+
+      t = g_get_monotonic_time () - t;
+
+      t_min    = MIN (t_min, t);
+      t_total += t;
+
+      if (teardown)
+        teardown (state);
+    }
+
+  if (setup)
+    setup (state);
+
+  h  = get_heap ();
+  a0 = n_allocs;
+  s0 = *n_syscalls;
+  count_start ();
+
+  func (state);
+
+  count_stop ();
+  syscalls = *n_syscalls - s0 - overhead;
+  allocs   = n_allocs - a0;
+  heap     = get_heap () - h;
+
+  if (teardown)
+    teardown (state);
+
+  if (traced)
+    g_snprintf (count, sizeof (count), "%" G_GUINT64_FORMAT, syscalls);
+  else
+    strcpy (count, "-");
+
+  printf ("  %-14s %10.3f %10.3f %8s %8" G_GUINT64_FORMAT " %10.1f\n",
+          name, t_min / 1000.0, t_total / 1000.0 / iterations, count, allocs,
+          heap / 1024.0);
+}
+
+static int
+remove_cb (const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+  if (remove (path))
+    g_warning ("Failed to remove %s: %s", path, strerror (errno));
+
+  return 0;
+}
+
+static void
+remove_tree (const char *path)
+{
+  nftw (path, remove_cb, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void
+clear_cache (BenchState *state)
+{
+  remove_tree (state->cache);
+  g_mkdir_with_parents (state->cache, 0755);
+}
+
+static void
+load_table (BenchState *state)
+{
+  state->tab = zonetab_new ();
+}
+
+static void
+free_table (BenchState *state)
+{
+  zonetab_unref (state->tab);
+  state->tab = NULL;
+}
+
+static void
+find_zones (BenchState *state)
+{
+  const ZoneTab *tab = state->tab;
+  guint          i;
+
+  for (i = 0; i < tab->n_entries; i++)
+    if (!zonetab_find (tab, ZONE_STR (tab, tab->entries[i].zone)))
+      g_warning ("Zone %s not found", ZONE_STR (tab, tab->entries[i].zone));
+}
+
+static void
+forget_offsets (BenchState *state)
+{
+  tzfile_forget (NULL);
+}
+
+static void
+get_offsets (BenchState *state)
+{
+  const ZoneTab *tab = state->tab;
+  gint64         now = time (NULL);
+  TzOffset       off;
+  guint          i;
+
+  for (i = 0; i < tab->n_entries; i++)
+    tzfile_get_offset (ZONE_STR (tab, tab->entries[i].zone), now, &off);
+}
+
+static void
+apply_zone (BenchState *state)
+{
+  char *zone = g_strdup (state->apply);
+
+  if (!set_timezone (zone))
+    g_warning ("Failed to apply %s", state->apply);
+
+  g_free (zone);
+}
+
+static void
+bench_tree (BenchState *state)
+{
+  struct rusage ru;
+
+  zonetab_set_root (state->root);
+  zonetab_set_bundle (bundle);
+  timezone_set_etc_dir (state->etc);
+
+  printf ("  %-14s %10s %10s %8s %8s %10s\n",
+          "phase", "min ms", "mean ms", "syscalls", "allocs", "heap KiB");
+
+  run_phase ("load cold", clear_cache, load_table, free_table, state);
+  run_phase ("load warm", NULL, load_table, free_table, state);
+
+  load_table (state);
+  printf ("  (%u zones, %u missing, %u regions)\n", state->tab->n_entries,
+          state->tab->n_missing, state->tab->n_regions);
+
+  if (!state->tab->n_entries)
+    {
+      free_table (state);
+      return;
+    }
+
+  run_phase ("find all", NULL, find_zones, NULL, state);
+  run_phase ("offsets cold", forget_offsets, get_offsets, NULL, state);
+  run_phase ("offsets warm", NULL, get_offsets, NULL, state);
+
+  state->apply = g_strdup (ZONE_STR (state->tab, state->tab->entries[0].zone));
+  free_table (state);
+
+  /* first call loads the shared table and sets up the monitors */
+  apply_zone (state);
+  run_phase ("apply", NULL, apply_zone, NULL, state);
+
+  getrusage (RUSAGE_SELF, &ru);
+  printf ("  peak RSS: %ld KiB\n", ru.ru_maxrss);
+}
+
+/*
+ * Generates a zoneinfo tree with a zone.tab of the given number of lines;
+ * all the zone files are hard links to a single copy of a real zone file.
+ */
+static gboolean
+make_tree (const char *dir, guint lines)
+{
+  static const char *regions[] =
+    {
+      "Africa", "America", "Antarctica", "Arctic", "Asia",
+      "Atlantic", "Australia", "Europe", "Indian", "Pacific"
+    };
+  GRand    *rand = g_rand_new_with_seed (lines);
+  GString  *tab = g_string_new ("# synthetic zone.tab\n");
+  char     *template, *data, *path, *iso;
+  gsize     len, iso_len;
+  guint     i;
+  gboolean  retval = FALSE;
+
+  path = g_build_filename (ZONEINFO_DIR, TEMPLATE_ZONE, NULL);
+
+  if (!g_file_get_contents (path, &data, &len, NULL))
+    {
+      g_warning ("Failed to read %s", path);
+      g_free (path);
+      goto finish;
+    }
+
+  g_free (path);
+
+  template = g_build_filename (dir, "Template", NULL);
+  g_file_set_contents (template, data, len, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (regions); i++)
+    {
+      path = g_build_filename (dir, regions[i], NULL);
+      g_mkdir_with_parents (path, 0755);
+      g_free (path);
+    }
+
+  for (i = 0; i < lines; i++)
+    {
+      const char *region = regions[i % G_N_ELEMENTS (regions)];
+      int         lat = g_rand_int_range (rand, -90 * 60, 90 * 60 + 1);
+      int         lon = g_rand_int_range (rand, -180 * 60, 180 * 60 + 1);
+      char        zone[64];
+
+      g_snprintf (zone, sizeof (zone), "%s/City_%06u", region, i);
+
+      g_string_append_printf (tab, "%c%c\t%c%02d%02d%c%03d%02d\t%s\n",
+                              'A' + i % 26, 'A' + i / 26 % 26,
+                              lat < 0 ? '-' : '+', ABS (lat) / 60,
+                              ABS (lat) % 60,
+                              lon < 0 ? '-' : '+', ABS (lon) / 60,
+                              ABS (lon) % 60, zone);
+
+      path = g_build_filename (dir, zone, NULL);
+
+      if (link (template, path) &&
+          !g_file_set_contents (path, data, len, NULL))
+        {
+          g_warning ("Failed to create %s", path);
+          g_free (path);
+          goto cleanup;
+        }
+
+      g_free (path);
+    }
+
+  path = g_build_filename (dir, "zone.tab", NULL);
+  retval = g_file_set_contents (path, tab->str, tab->len, NULL);
+  g_free (path);
+
+  /* real country names, so the join is exercised too */
+  path = g_build_filename (ZONEINFO_DIR, "iso3166.tab", NULL);
+
+  if (retval && g_file_get_contents (path, &iso, &iso_len, NULL))
+    {
+      g_free (path);
+      path = g_build_filename (dir, "iso3166.tab", NULL);
+      g_file_set_contents (path, iso, iso_len, NULL);
+      g_free (iso);
+    }
+
+  g_free (path);
+
+ cleanup:
+  g_free (template);
+  g_free (data);
+
+ finish:
+  g_string_free (tab, TRUE);
+  g_rand_free (rand);
+
+  return retval;
+}
+
+/*
+ * Runs the child until it exits, counting the syscalls it makes between the
+ * SIGUSR1 and SIGUSR2 it raises.
+ */
+static void
+trace_child (pid_t pid)
+{
+  gboolean counting = FALSE, entering = FALSE;
+  int      status, sig;
+
+  ptrace (PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD);
+  ptrace (PTRACE_CONT, pid, NULL, NULL);
+
+  while (waitpid (pid, &status, 0) == pid && WIFSTOPPED (status))
+    {
+      sig = WSTOPSIG (status);
+
+      if (sig == (SIGTRAP | 0x80))
+        {
+          if ((entering = !entering))
+            (*n_syscalls)++;
+
+          sig = 0;
+        }
+      else if (sig == SIGUSR1 || sig == SIGUSR2)
+        {
+          counting = sig == SIGUSR1;
+          entering = FALSE;
+          sig = 0;
+        }
+
+      ptrace (counting ? PTRACE_SYSCALL : PTRACE_CONT, pid, NULL,
+              GINT_TO_POINTER (sig));
+    }
+}
+
+static void
+run_child (BenchState *state)
+{
+  pid_t pid;
+  int   status;
+
+  fflush (stdout);
+
+  if ((pid = fork ()) < 0)
+    {
+      g_warning ("Failed to fork: %s", strerror (errno));
+      return;
+    }
+
+  if (!pid)
+    {
+      /* the parent picks us up at the SIGSTOP */
+      if (ptrace (PTRACE_TRACEME, 0, NULL, NULL))
+        {
+          g_warning ("Failed to trace the benchmark, no syscall counts: %s",
+                     strerror (errno));
+
+          signal (SIGUSR1, SIG_IGN);
+          signal (SIGUSR2, SIG_IGN);
+        }
+      else
+        {
+          traced = TRUE;
+          raise (SIGSTOP);
+        }
+
+      bench_tree (state);
+      fflush (stdout);
+      _exit (0);
+    }
+
+  if (waitpid (pid, &status, 0) == pid && WIFSTOPPED (status))
+    trace_child (pid);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError         *error = NULL;
+  BenchState      state = {0,};
+  char           *tmp;
+  guint           i;
+
+  context = g_option_context_new ("- benchmark the timezone code");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  iterations = MAX (iterations, 1);
+
+  tmp = g_build_filename (g_get_tmp_dir (), "tz-bench-XXXXXX", NULL);
+
+  if (!mkdtemp (tmp))
+    {
+      fprintf (stderr, "Failed to create %s: %s\n", tmp, strerror (errno));
+      return 1;
+    }
+
+  /* keep the zone index out of the real cache */
+  state.cache = g_build_filename (tmp, "cache", NULL);
+  g_setenv ("XDG_CACHE_HOME", state.cache, TRUE);
+
+  state.etc = g_build_filename (tmp, "etc", NULL);
+  g_mkdir_with_parents (state.etc, 0755);
+
+  g_type_init ();
+
+  /* shared with the child, so it can read what the parent counts */
+  n_syscalls = mmap (NULL, sizeof (*n_syscalls), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (n_syscalls == MAP_FAILED)
+    {
+      fprintf (stderr, "Failed to map the counters: %s\n", strerror (errno));
+      return 1;
+    }
+
+  /* errors from the timezone code */
+  output_set_stream (stderr);
+  output_set_buffered (FALSE);
+
+  if (root || bundle)
+    {
+      if (bundle)
+        printf ("tzdata bundle %s\n", bundle);
+      else
+        printf ("zoneinfo tree %s\n", root);
+
+      state.root = root ? root : ZONEINFO_DIR;
+      run_child (&state);
+    }
+  else
+    {
+      static char *default_sizes[] = {"400", "1000", "10000", "100000", NULL};
+
+      if (!sizes)
+        sizes = default_sizes;
+
+      for (i = 0; sizes[i]; i++)
+        {
+          guint lines = strtoul (sizes[i], NULL, 10);
+
+          char  *name  = g_strdup_printf ("zoneinfo-%u", lines);
+
+          state.root = g_build_filename (tmp, name, NULL);
+          g_free (name);
+          g_mkdir_with_parents (state.root, 0755);
+
+          printf ("zone.tab with %u lines\n", lines);
+
+          if (make_tree (state.root, lines))
+            run_child (&state);
+
+          if (!keep)
+            remove_tree (state.root);
+
+          g_free (state.root);
+        }
+    }
+
+  if (!keep)
+    remove_tree (tmp);
+  else
+    printf ("generated data kept in %s\n", tmp);
+
+  return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+/*
+ * Packs a zoneinfo tree into a tzdata bundle (see tzbundle.h); the bundle
+ * holds the tab files, and the zones listed in them plus any zones given on
+ * the command line, e.g.,
+ *
+ *   tz-pack -r /usr/share/zoneinfo tzdata.bundle UTC
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include "tzbundle.h"
+#include "zonetab.h"
+
+static const char *tab_files[] = { "zone1970.tab", "zone.tab", "iso3166.tab" };
+
+static char *root = NULL;
+
+static GOptionEntry options[] =
+{
+  {"root", 'r', 0, G_OPTION_ARG_FILENAME, &root,
+   "The zoneinfo tree to pack (" ZONEINFO_DIR ")", "DIR"},
+  {NULL}
+};
+
+static void
+add_file (GPtrArray *names, const char *name)
+{
+  char *path = g_build_filename (root, name, NULL);
+
+  /* pruned trees do not have all the zones listed */
+  if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+    g_ptr_array_add (names, g_strdup (name));
+  else
+    fprintf (stderr, "Skipping %s, not in the tree\n", name);
+
+  g_free (path);
+}
+
+/*
+ * Adds the zones listed in a zone list, the third field of each line.
+ */
+static void
+add_zones (GPtrArray *names, const char *tab)
+{
+  char  *path = g_build_filename (root, tab, NULL);
+  char  *data;
+  char **lines;
+  guint  i;
+
+  if (!g_file_get_contents (path, &data, NULL, NULL))
+    {
+      g_free (path);
+      return;
+    }
+
+  g_free (path);
+
+  lines = g_strsplit (data, "\n", -1);
+
+  for (i = 0; lines[i]; i++)
+    {
+      char **fields;
+
+      if (lines[i][0] == '#' || !lines[i][0])
+        continue;
+
+      fields = g_strsplit (lines[i], "\t", 4);
+
+      if (g_strv_length (fields) >= 3)
+        add_file (names, fields[2]);
+
+      g_strfreev (fields);
+    }
+
+  g_strfreev (lines);
+  g_free (data);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError         *error = NULL;
+  GPtrArray      *names;
+  char           *path;
+  int             i;
+
+  context = g_option_context_new ("BUNDLE [ZONE...] - pack tzdata bundle");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "Usage: %s [-r DIR] BUNDLE [ZONE...]\n", argv[0]);
+      return 1;
+    }
+
+  if (!root)
+    root = ZONEINFO_DIR;
+
+  names = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < (int) G_N_ELEMENTS (tab_files); i++)
+    {
+      path = g_build_filename (root, tab_files[i], NULL);
+
+      if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+        {
+          g_ptr_array_add (names, g_strdup (tab_files[i]));
+
+          if (strcmp (tab_files[i], "iso3166.tab"))
+            add_zones (names, tab_files[i]);
+        }
+
+      g_free (path);
+    }
+
+  for (i = 2; i < argc; i++)
+    add_file (names, argv[i]);
+
+  g_ptr_array_add (names, NULL);
+
+  if (!tzbundle_write (argv[1], root, (char **) names->pdata, &error))
+    {
+      fprintf (stderr, "Failed to write %s: %s\n", argv[1], error->message);
+      return 1;
+    }
+
+  printf ("Packed %u files into %s\n", names->len - 1, argv[1]);
+
+  g_ptr_array_free (names, TRUE);
+
+  return 0;
+}
@@ -0,0 +1,366 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "tzbundle.h"
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint32 n_entries;
+  guint32 names_len;
+} TzBundleHeader;
+
+typedef struct
+{
+  guint32 name;
+  guint32 offset;
+  guint32 size;
+  guint32 reserved;
+} TzBundleEntry;
+
+struct _TzBundle
+{
+  const guchar        *data;
+  gsize                size;
+
+  const TzBundleEntry *entries;
+  guint                n_entries;
+  const char          *names;
+};
+
+#define ENTRY_NAME(b,e) ((b)->names + GUINT32_FROM_LE ((e)->name))
+
+/*
+ * Checks the bundle is consistent, so that we can trust the offsets.
+ */
+static gboolean
+tzbundle_validate (TzBundle *bundle)
+{
+  const TzBundleHeader *h = (const TzBundleHeader *) bundle->data;
+  guint32               names_len;
+  gsize                 data_start;
+  guint                 i;
+
+  if (bundle->size < sizeof (*h) ||
+      GUINT32_FROM_LE (h->magic) != TZ_BUNDLE_MAGIC ||
+      GUINT32_FROM_LE (h->version) != TZ_BUNDLE_VERSION)
+    return FALSE;
+
+  bundle->n_entries = GUINT32_FROM_LE (h->n_entries);
+  names_len         = GUINT32_FROM_LE (h->names_len);
+
+  data_start = sizeof (*h) +
+    (gsize) bundle->n_entries * sizeof (TzBundleEntry) + names_len;
+
+  if (!names_len || data_start > bundle->size)
+    return FALSE;
+
+  bundle->entries = (const TzBundleEntry *)(h + 1);
+  bundle->names   = (const char *)(bundle->entries + bundle->n_entries);
+
+  if (bundle->names[names_len - 1])
+    return FALSE;
+
+  for (i = 0; i < bundle->n_entries; i++)
+    {
+      const TzBundleEntry *e = &bundle->entries[i];
+
+      if (GUINT32_FROM_LE (e->name) >= names_len ||
+          (gsize) GUINT32_FROM_LE (e->offset) +
+          GUINT32_FROM_LE (e->size) > bundle->size)
+        return FALSE;
+
+      /* the lookups rely on the order */
+      if (i && strcmp (ENTRY_NAME (bundle, e - 1), ENTRY_NAME (bundle, e)) >= 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+TzBundle *
+tzbundle_open (const char *path)
+{
+  TzBundle    *bundle;
+  struct stat  st;
+  void        *map;
+  int          fd;
+
+  if ((fd = open (path, O_RDONLY | O_CLOEXEC)) < 0)
+    return NULL;
+
+  if (fstat (fd, &st) < 0 || st.st_size < (off_t)sizeof (TzBundleHeader))
+    {
+      close (fd);
+      return NULL;
+    }
+
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return NULL;
+
+  bundle = g_slice_new0 (TzBundle);
+  bundle->data = map;
+  bundle->size = st.st_size;
+
+  if (!tzbundle_validate (bundle))
+    {
+      g_warning ("%s is not a valid tzdata bundle", path);
+      tzbundle_close (bundle);
+      return NULL;
+    }
+
+  return bundle;
+}
+
+void
+tzbundle_close (TzBundle *bundle)
+{
+  if (!bundle)
+    return;
+
+  munmap ((void *) bundle->data, bundle->size);
+  g_slice_free (TzBundle, bundle);
+}
+
+/*
+ * Returns the contents of the named file, which remain valid until the bundle
+ * is closed.
+ */
+gconstpointer
+tzbundle_lookup (const TzBundle *bundle, const char *name, gsize *len)
+{
+  guint lo = 0;
+  guint hi = bundle->n_entries;
+
+  while (lo < hi)
+    {
+      guint                mid = lo + (hi - lo) / 2;
+      const TzBundleEntry *e = &bundle->entries[mid];
+      int                  c = strcmp (name, ENTRY_NAME (bundle, e));
+
+      if (!c)
+        {
+          if (len)
+            *len = GUINT32_FROM_LE (e->size);
+
+          return bundle->data + GUINT32_FROM_LE (e->offset);
+        }
+
+      if (c < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return NULL;
+}
+
+/*
+ * Whether data points into the bundle, i.e., was returned by the lookup.
+ */
+gboolean
+tzbundle_contains (const TzBundle *bundle, gconstpointer data)
+{
+  const guchar *p = data;
+
+  return bundle && p >= bundle->data && p < bundle->data + bundle->size;
+}
+
+/*
+ * Writing the bundle; the contents of all the files are held in memory, which
+ * is fine for the size of tzdata.
+ */
+typedef struct
+{
+  char    *data;
+  gsize    len;
+  guint32  offset;
+} TzBlob;
+
+static guint
+blob_hash (gconstpointer key)
+{
+  const TzBlob *b = key;
+  guint         h = 5381;
+  gsize         i;
+
+  for (i = 0; i < b->len; i++)
+    h = h * 33 + (guchar) b->data[i];
+
+  return h;
+}
+
+static gboolean
+blob_equal (gconstpointer a, gconstpointer b)
+{
+  const TzBlob *b1 = a;
+  const TzBlob *b2 = b;
+
+  return b1->len == b2->len && !memcmp (b1->data, b2->data, b1->len);
+}
+
+static void
+blob_free (gpointer data)
+{
+  TzBlob *b = data;
+
+  g_free (b->data);
+  g_slice_free (TzBlob, b);
+}
+
+static int
+name_cmp (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(char **) a, *(char **) b);
+}
+
+/*
+ * Packs the files of the zoneinfo tree at root given by the NULL terminated
+ * list of names into a bundle.
+ */
+gboolean
+tzbundle_write (const char *path, const char *root, char **names,
+                GError **error)
+{
+  TzBundleHeader  h;
+  GPtrArray      *sorted;
+  GPtrArray      *blobs;
+  GHashTable     *unique;
+  GString        *out;
+  GString        *pool;
+  gsize           offset;
+  guint           i, n;
+  gboolean        retval = FALSE;
+
+  sorted = g_ptr_array_new ();
+
+  for (i = 0; names[i]; i++)
+    g_ptr_array_add (sorted, names[i]);
+
+  g_ptr_array_sort (sorted, name_cmp);
+
+  /* drop duplicate names */
+  for (i = n = 0; i < sorted->len; i++)
+    if (!n || strcmp (g_ptr_array_index (sorted, n - 1),
+                      g_ptr_array_index (sorted, i)))
+      g_ptr_array_index (sorted, n++) = g_ptr_array_index (sorted, i);
+
+  g_ptr_array_set_size (sorted, n);
+
+  blobs  = g_ptr_array_new ();
+  unique = g_hash_table_new_full (blob_hash, blob_equal, blob_free, NULL);
+  pool   = g_string_new (NULL);
+  out    = g_string_new (NULL);
+
+  for (i = 0; i < sorted->len; i++)
+    {
+      const char *name = g_ptr_array_index (sorted, i);
+      char       *file = g_build_filename (root, name, NULL);
+      TzBlob     *blob = g_slice_new0 (TzBlob);
+      TzBlob     *existing;
+
+      if (!g_file_get_contents (file, &blob->data, &blob->len, error))
+        {
+          g_free (file);
+          g_slice_free (TzBlob, blob);
+          goto finish;
+        }
+
+      g_free (file);
+
+      if ((existing = g_hash_table_lookup (unique, blob)))
+        {
+          blob_free (blob);
+          blob = existing;
+        }
+      else
+        g_hash_table_add (unique, blob);
+
+      g_ptr_array_add (blobs, blob);
+
+      g_string_append (pool, name);
+      g_string_append_c (pool, 0);
+    }
+
+  offset = sizeof (h) + sorted->len * sizeof (TzBundleEntry) + pool->len;
+
+  h.magic     = GUINT32_TO_LE (TZ_BUNDLE_MAGIC);
+  h.version   = GUINT32_TO_LE (TZ_BUNDLE_VERSION);
+  h.n_entries = GUINT32_TO_LE (sorted->len);
+  h.names_len = GUINT32_TO_LE (pool->len);
+
+  g_string_append_len (out, (const char *)&h, sizeof (h));
+
+  /* the data go after the names, in the order of first use */
+  for (i = 0, n = 0; i < blobs->len; i++)
+    {
+      TzBlob        *blob = g_ptr_array_index (blobs, i);
+      TzBundleEntry  e;
+
+      if (!blob->offset)
+        {
+          blob->offset = offset;
+          offset      += blob->len;
+        }
+
+      e.name     = GUINT32_TO_LE (n);
+      e.offset   = GUINT32_TO_LE (blob->offset);
+      e.size     = GUINT32_TO_LE (blob->len);
+      e.reserved = 0;
+
+      g_string_append_len (out, (const char *)&e, sizeof (e));
+
+      n += strlen (g_ptr_array_index (sorted, i)) + 1;
+    }
+
+  g_string_append_len (out, pool->str, pool->len);
+
+  for (i = 0; i < blobs->len; i++)
+    {
+      TzBlob *blob = g_ptr_array_index (blobs, i);
+
+      if (blob->offset == out->len)
+        g_string_append_len (out, blob->data, blob->len);
+    }
+
+  retval = g_file_set_contents (path, out->str, out->len, error);
+
+ finish:
+  g_ptr_array_free (sorted, TRUE);
+  g_ptr_array_free (blobs, TRUE);
+  g_hash_table_destroy (unique);
+  g_string_free (pool, TRUE);
+  g_string_free (out, TRUE);
+
+  return retval;
+}
@@ -0,0 +1,54 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_TZBUNDLE_H
+#define GUACA_TZBUNDLE_H
+
+#include <glib.h>
+
+/*
+ * A tzdata bundle packs the parts of the zoneinfo tree we use into a single
+ * file, for images that do not ship the tree itself. It holds named files, the
+ * tab files and the TZif data of the zones, laid out as:
+ *
+ *   header     magic 'GTZB', version, n_entries, names_len
+ *   entries    n_entries of {name, offset, size, reserved}, sorted by name
+ *   names      names_len bytes of NUL terminated names; entry names are
+ *              offsets into this
+ *   data       the file contents, entry offsets are from the start of the
+ *              bundle; files with identical contents, e.g., zone links, share
+ *              the data
+ *
+ * All the numbers are 32bit little endian. Bundles are made with tz-pack.
+ */
+#define TZ_BUNDLE_MAGIC   0x425a5447 /* GTZB */
+#define TZ_BUNDLE_VERSION 1
+
+typedef struct _TzBundle TzBundle;
+
+TzBundle      *tzbundle_open     (const char *path);
+void           tzbundle_close    (TzBundle *bundle);
+gconstpointer  tzbundle_lookup   (const TzBundle *bundle,
+                                  const char     *name,
+                                  gsize          *len);
+gboolean       tzbundle_contains (const TzBundle *bundle,
+                                  gconstpointer   data);
+gboolean       tzbundle_write    (const char  *path,
+                                  const char  *root,
+                                  char       **names,
+                                  GError     **error);
+
+#endif
@@ -0,0 +1,590 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <glib.h>
+
+#include "tzfile.h"
+#include "zonetab.h"
+
+/*
+ * Minimal reader for the TZif files in the zoneinfo tree (see tzfile(5)).
+ *
+ * We only ever need the offset in force at a given moment, so rather than
+ * loading the whole file we binary search the transition times in place in
+ * the mapped file (or the tzdata bundle); past the last transition the POSIX
+ * TZ string in the footer of version 2+ files gives the rule for the years to
+ * come.
+ *
+ * Each result is cached along with the interval it is valid for, so that a
+ * zone file is only read again when its offset changes.
+ */
+#define TZ_HEADER_LEN 44
+
+typedef struct
+{
+  guint32 isutcnt;
+  guint32 isstdcnt;
+  guint32 leapcnt;
+  guint32 timecnt;
+  guint32 typecnt;
+  guint32 charcnt;
+} TzCounts;
+
+typedef struct
+{
+  TzOffset offset;
+  gint64   from;  /* the offset is valid for [from, until) */
+  gint64   until;
+} TzResult;
+
+/* one of the transition dates of a POSIX TZ rule */
+typedef struct
+{
+  char   kind;  /* 'J' for Julian day, 'D' for zero based day, or 'M' */
+  int    month;
+  int    week;
+  int    day;
+  gint32 time;  /* seconds after local midnight */
+} TzRuleDate;
+
+typedef struct
+{
+  char       std[16];
+  char       dst[16];
+  gint32     std_off;
+  gint32     dst_off;
+  gboolean   has_dst;
+  TzRuleDate start;
+  TzRuleDate end;
+} TzRule;
+
+static GHashTable *tz_cache = NULL;
+
+static guint32
+get_be32 (const guchar *p)
+{
+  return ((guint32)p[0] << 24) | ((guint32)p[1] << 16) |
+    ((guint32)p[2] << 8) | p[3];
+}
+
+static gint64
+get_time (const guchar *times, guint i, guint time_size)
+{
+  const guchar *p = times + i * time_size;
+
+  if (time_size == 4)
+    return (gint32) get_be32 (p);
+
+  return (gint64)(((guint64) get_be32 (p) << 32) | get_be32 (p + 4));
+}
+
+static gboolean
+read_header (const guchar *p, gsize len, TzCounts *c, int *version)
+{
+  if (len < TZ_HEADER_LEN || memcmp (p, "TZif", 4))
+    return FALSE;
+
+  *version = p[4] ? p[4] - '0' : 1;
+
+  c->isutcnt  = get_be32 (p + 20);
+  c->isstdcnt = get_be32 (p + 24);
+  c->leapcnt  = get_be32 (p + 28);
+  c->timecnt  = get_be32 (p + 32);
+  c->typecnt  = get_be32 (p + 36);
+  c->charcnt  = get_be32 (p + 40);
+
+  return c->typecnt && c->charcnt;
+}
+
+static gsize
+block_size (const TzCounts *c, guint time_size)
+{
+  return (gsize)c->timecnt * (time_size + 1) + (gsize)c->typecnt * 6 +
+    c->charcnt + (gsize)c->leapcnt * (time_size + 4) +
+    c->isstdcnt + c->isutcnt;
+}
+
+static void
+copy_abbrev (char *dst, const char *src, gsize len)
+{
+  gsize n = MIN (len, sizeof (((TzOffset *)0)->abbrev) - 1);
+
+  memcpy (dst, src, n);
+  dst[n] = 0;
+}
+
+/*
+ * POSIX TZ string parsing; see tzset(3) for the syntax.
+ */
+static gboolean
+parse_name (const char **s, const char *end, char *name)
+{
+  const char *p = *s;
+  const char *start;
+
+  if (p < end && *p == '<')
+    {
+      start = ++p;
+
+      while (p < end && *p != '>')
+        p++;
+
+      if (p == end)
+        return FALSE;
+
+      copy_abbrev (name, start, p - start);
+      *s = p + 1;
+      return TRUE;
+    }
+
+  start = p;
+
+  while (p < end && isalpha (*p))
+    p++;
+
+  if (p - start < 3)
+    return FALSE;
+
+  copy_abbrev (name, start, p - start);
+  *s = p;
+  return TRUE;
+}
+
+static gboolean
+parse_hms (const char **s, const char *end, gint32 *secs)
+{
+  const char *p = *s;
+  int         sign = 1;
+  int         part[3] = {0, 0, 0};
+  int         i;
+
+  if (p < end && (*p == '+' || *p == '-'))
+    sign = *p++ == '-' ? -1 : 1;
+
+  for (i = 0; i < 3; i++)
+    {
+      const char *start = p;
+
+      if (i && (p == end || *p != ':'))
+        break;
+
+      if (i)
+        start = ++p;
+
+      while (p < end && isdigit (*p) && p - start < 3)
+        part[i] = part[i] * 10 + (*p++ - '0');
+
+      if (p == start)
+        return FALSE;
+    }
+
+  *secs = sign * (part[0] * 3600 + part[1] * 60 + part[2]);
+  *s = p;
+  return TRUE;
+}
+
+static gboolean
+parse_number (const char **s, const char *end, int *n)
+{
+  const char *p = *s;
+
+  *n = 0;
+
+  while (p < end && isdigit (*p) && p - *s < 3)
+    *n = *n * 10 + (*p++ - '0');
+
+  if (p == *s)
+    return FALSE;
+
+  *s = p;
+  return TRUE;
+}
+
+static gboolean
+parse_rule_date (const char **s, const char *end, TzRuleDate *date)
+{
+  const char *p = *s;
+
+  date->time = 7200;
+
+  if (p < end && *p == 'J')
+    {
+      p++;
+      date->kind = 'J';
+
+      if (!parse_number (&p, end, &date->day) ||
+          date->day < 1 || date->day > 365)
+        return FALSE;
+    }
+  else if (p < end && *p == 'M')
+    {
+      p++;
+      date->kind = 'M';
+
+      if (!parse_number (&p, end, &date->month) || p == end || *p++ != '.' ||
+          !parse_number (&p, end, &date->week) || p == end || *p++ != '.' ||
+          !parse_number (&p, end, &date->day) ||
+          date->month < 1 || date->month > 12 ||
+          date->week < 1 || date->week > 5 || date->day > 6)
+        return FALSE;
+    }
+  else
+    {
+      date->kind = 'D';
+
+      if (!parse_number (&p, end, &date->day) || date->day > 365)
+        return FALSE;
+    }
+
+  if (p < end && *p == '/')
+    {
+      p++;
+
+      if (!parse_hms (&p, end, &date->time))
+        return FALSE;
+    }
+
+  *s = p;
+  return TRUE;
+}
+
+static gboolean
+parse_rule (const char *s, const char *end, TzRule *rule)
+{
+  memset (rule, 0, sizeof (*rule));
+
+  if (!parse_name (&s, end, rule->std) || !parse_hms (&s, end, &rule->std_off))
+    return FALSE;
+
+  /* POSIX offsets are west of UTC */
+  rule->std_off = -rule->std_off;
+
+  if (s == end)
+    return TRUE;
+
+  if (!parse_name (&s, end, rule->dst))
+    return FALSE;
+
+  rule->has_dst = TRUE;
+  rule->dst_off = rule->std_off + 3600;
+
+  if (s < end && *s != ',')
+    {
+      if (!parse_hms (&s, end, &rule->dst_off))
+        return FALSE;
+
+      rule->dst_off = -rule->dst_off;
+    }
+
+  if (s == end)
+    {
+      /* no rule given, the POSIX default is the US one */
+      rule->start.kind  = rule->end.kind = 'M';
+      rule->start.month = 3;
+      rule->start.week  = 2;
+      rule->end.month   = 11;
+      rule->end.week    = 1;
+      rule->start.time  = rule->end.time = 7200;
+      return TRUE;
+    }
+
+  return *s++ == ',' && parse_rule_date (&s, end, &rule->start) &&
+    s < end && *s++ == ',' && parse_rule_date (&s, end, &rule->end) &&
+    s == end;
+}
+
+static gboolean
+is_leap (int year)
+{
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/* days since the epoch of the given date of the proleptic Gregorian calendar */
+static gint64
+days_from_civil (int year, int month, int day)
+{
+  gint64 era, yoe, doy;
+
+  year -= month <= 2;
+  era = (year >= 0 ? year : year - 399) / 400;
+  yoe = year - era * 400;
+  doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static gint64
+rule_date_to_utc (const TzRuleDate *date, int year, gint32 utoff)
+{
+  static const int month_days[] = {31,28,31,30,31,30,31,31,30,31,30,31};
+  gint64 day = days_from_civil (year, 1, 1);
+
+  switch (date->kind)
+    {
+    case 'J':
+      day += date->day - 1 + (is_leap (year) && date->day >= 60);
+      break;
+    case 'D':
+      day += date->day;
+      break;
+    default:
+      {
+        gint64 first = days_from_civil (year, date->month, 1);
+        int    wday  = ((first + 4) % 7 + 7) % 7;
+        int    mdays = month_days[date->month - 1] +
+          (date->month == 2 && is_leap (year));
+        int    mday;
+
+        mday = 1 + (date->day - wday + 7) % 7 + (date->week - 1) * 7;
+
+        if (mday > mdays)
+          mday -= 7;
+
+        day = first + mday - 1;
+      }
+    }
+
+  return day * 86400 + date->time - utoff;
+}
+
+static void
+rule_eval (const TzRule *rule, gint64 when, TzResult *res)
+{
+  struct
+  {
+    gint64   at;
+    gboolean dst;
+  } ev[6], tmp;
+  struct tm  tm;
+  time_t     t = when + rule->std_off;
+  int        year, i, j, n = 0;
+  gboolean   dst;
+
+  if (!rule->has_dst)
+    {
+      res->offset.utoff  = rule->std_off;
+      res->offset.is_dst = FALSE;
+      strcpy (res->offset.abbrev, rule->std);
+      return;
+    }
+
+  gmtime_r (&t, &tm);
+  year = tm.tm_year + 1900;
+
+  /*
+   * The transitions of the surrounding years cover both the hemispheres and
+   * the ends of the year without any special casing.
+   */
+  for (i = year - 1; i <= year + 1; i++)
+    {
+      ev[n].at    = rule_date_to_utc (&rule->start, i, rule->std_off);
+      ev[n++].dst = TRUE;
+      ev[n].at    = rule_date_to_utc (&rule->end, i, rule->dst_off);
+      ev[n++].dst = FALSE;
+    }
+
+  for (i = 1; i < n; i++)
+    for (j = i; j > 0 && ev[j].at < ev[j - 1].at; j--)
+      {
+        tmp       = ev[j];
+        ev[j]     = ev[j - 1];
+        ev[j - 1] = tmp;
+      }
+
+  for (i = 0; i < n && ev[i].at <= when; i++);
+
+  dst = i ? ev[i - 1].dst : !ev[0].dst;
+
+  if (i)
+    res->from = MAX (res->from, ev[i - 1].at);
+
+  if (i < n)
+    res->until = ev[i].at;
+
+  res->offset.utoff  = dst ? rule->dst_off : rule->std_off;
+  res->offset.is_dst = dst;
+  strcpy (res->offset.abbrev, dst ? rule->dst : rule->std);
+}
+
+static gboolean
+tz_parse (const guchar *data, gsize len, gint64 when, TzResult *res)
+{
+  const guchar *p = data;
+  const guchar *times, *idx, *types;
+  const char   *chars;
+  const char   *footer = NULL;
+  const char   *footer_end = NULL;
+  TzCounts      c;
+  TzRule        rule;
+  guint         time_size = 4;
+  guint         lo, hi, type;
+  gsize         size;
+  int           version;
+
+  if (!read_header (p, len, &c, &version))
+    return FALSE;
+
+  size = TZ_HEADER_LEN + block_size (&c, 4);
+
+  if (size > len)
+    return FALSE;
+
+  /* version 2+ files have the 64bit data following the legacy block */
+  if (version >= 2)
+    {
+      p   += size;
+      len -= size;
+
+      if (!read_header (p, len, &c, &version))
+        return FALSE;
+
+      time_size = 8;
+      size = TZ_HEADER_LEN + block_size (&c, 8);
+
+      if (size > len)
+        return FALSE;
+
+      if (size < len && p[size] == '\n')
+        {
+          footer = (const char *)p + size + 1;
+          footer_end = memchr (footer, '\n', len - size - 1);
+        }
+    }
+
+  times = p + TZ_HEADER_LEN;
+  idx   = times + (gsize)c.timecnt * time_size;
+  types = idx + c.timecnt;
+  chars = (const char *)types + (gsize)c.typecnt * 6;
+
+  res->from  = G_MININT64;
+  res->until = G_MAXINT64;
+
+  /* count of the transitions at or before when */
+  lo = 0;
+  hi = c.timecnt;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (get_time (times, mid, time_size) <= when)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo == c.timecnt && footer_end && footer_end > footer &&
+      parse_rule (footer, footer_end, &rule))
+    {
+      if (lo)
+        res->from = get_time (times, lo - 1, time_size);
+
+      rule_eval (&rule, when, res);
+      return TRUE;
+    }
+
+  if (lo)
+    {
+      type = idx[lo - 1];
+      res->from = get_time (times, lo - 1, time_size);
+    }
+  else
+    {
+      /* before the first transition use the first standard time type */
+      for (type = 0; type < c.typecnt && types[type * 6 + 4]; type++);
+
+      if (type == c.typecnt)
+        type = 0;
+    }
+
+  if (lo < c.timecnt)
+    res->until = get_time (times, lo, time_size);
+
+  if (type >= c.typecnt || types[type * 6 + 5] >= c.charcnt)
+    return FALSE;
+
+  res->offset.utoff  = (gint32) get_be32 (types + type * 6);
+  res->offset.is_dst = types[type * 6 + 4] != 0;
+  copy_abbrev (res->offset.abbrev, chars + types[type * 6 + 5],
+               strnlen (chars + types[type * 6 + 5],
+                        c.charcnt - types[type * 6 + 5]));
+
+  return TRUE;
+}
+
+/*
+ * Looks up the offset of the zone in force at the given time (in seconds
+ * since the epoch).
+ */
+gboolean
+tzfile_get_offset (const char *zone, gint64 when, TzOffset *offset)
+{
+  TzResult      *cached;
+  TzResult       res;
+  gconstpointer  data;
+  gsize          len = 0;
+  gboolean       retval = FALSE;
+
+  if (!tz_cache)
+    tz_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if ((cached = g_hash_table_lookup (tz_cache, zone)) &&
+      when >= cached->from && when < cached->until)
+    {
+      *offset = cached->offset;
+      return TRUE;
+    }
+
+  if (!(data = zonetab_map_file (zone, &len)))
+    return FALSE;
+
+  retval = tz_parse (data, len, when, &res);
+  zonetab_unmap_file (data, len);
+
+  if (retval)
+    {
+      cached  = g_new (TzResult, 1);
+      *cached = res;
+
+      g_hash_table_replace (tz_cache, g_strdup (zone), cached);
+      *offset = res.offset;
+    }
+
+  return retval;
+}
+
+/*
+ * Drops the cached offset of the zone, or of all zones if zone is NULL.
+ */
+void
+tzfile_forget (const char *zone)
+{
+  if (!tz_cache)
+    return;
+
+  if (zone)
+    g_hash_table_remove (tz_cache, zone);
+  else
+    g_hash_table_remove_all (tz_cache);
+}
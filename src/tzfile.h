@@ -0,0 +1,35 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_TZFILE_H
+#define GUACA_TZFILE_H
+
+#include <glib.h>
+
+/*
+ * Local time of a zone at a given moment, as read from its TZif file.
+ */
+typedef struct
+{
+  gint32   utoff;     /* seconds east of UTC */
+  gboolean is_dst;
+  char     abbrev[16];
+} TzOffset;
+
+gboolean tzfile_get_offset (const char *zone, gint64 when, TzOffset *offset);
+void     tzfile_forget     (const char *zone);
+
+#endif
@@ -0,0 +1,1648 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <math.h>
+#include <gio/gio.h>
+
+#include "zonetab.h"
+#include "tzfile.h"
+#include "tzbundle.h"
+
+/* the zoneinfo tree can be relocated with zonetab_set_root() */
+static char *zoneinfo_root = NULL;
+
+#define ZONE_ROOT (zoneinfo_root ? zoneinfo_root : ZONEINFO_DIR)
+
+/*
+ * The zone list; zone1970.tab is preferred when available, since it gives all
+ * the countries that use each zone, zone.tab is the legacy format with just
+ * one country per zone. Country names come from iso3166.tab.
+ */
+static const char *zone_tab_names[] = { "zone1970.tab", "zone.tab" };
+
+#define ISO3166_TAB "iso3166.tab"
+
+/*
+ * When the tzdata bundle is present all the zone data come from it, and the
+ * zoneinfo tree is not used at all.
+ */
+static char     *bundle_path = NULL;
+static gboolean  bundle_disabled = FALSE;
+static gboolean  bundle_opened = FALSE;
+static TzBundle *bundle = NULL;
+
+#define BUNDLE_PATH (bundle_path ? bundle_path : ZONE_BUNDLE)
+
+/*
+ * The zone table is kept on disk in the user cache directory, so that we do
+ * not have to parse zone.tab and walk the zoneinfo tree on each run. The file
+ * is just the header followed by the table memory block, and is used in place
+ * via mmap().
+ *
+ * The index is only valid for the zone list, iso3166.tab and zoneinfo
+ * directory it was built from; their stat data is stored in the header and
+ * checked on load, and the index is rebuilt whenever they do not match. Zone
+ * files added to or removed from the region subdirectories do not touch the
+ * root, so the stat data of the directories holding the listed zones is
+ * folded into a stamp, which is checked too.
+ */
+#define ZONE_CACHE_FILE    "guaca-cli-zones.idx"
+#define ZONE_CACHE_MAGIC   0x315a5447 /* GTZ1 */
+#define ZONE_CACHE_VERSION 6
+
+typedef struct
+{
+  guint32 tab_file;  /* index into zone_tab_names */
+  guint32 bundle;    /* the tab_ fields are for the bundle */
+  gint64  tab_mtime;
+  guint64 tab_ino;
+  guint64 tab_size;
+  gint64  iso_mtime;
+  guint64 iso_ino;
+  guint64 iso_size;
+  gint64  dir_mtime;
+  guint64 dir_ino;
+} ZoneCacheKey;
+
+typedef struct
+{
+  guint32      magic;
+  guint32      version;
+  ZoneCacheKey key;
+  guint32      n_entries;
+  guint32      n_missing;
+  guint32      n_regions;
+  guint32      strings_len;
+  guint64      dirs_stamp;
+} ZoneTabHeader;
+
+/* zone.tab line as collected by the parser, offsets into the string pool */
+typedef struct
+{
+  guint32  zone;
+  guint32  country;
+  guint32  country_name;
+  gint32   lat;
+  gint32   lon;
+  gboolean present;
+} ZoneRecord;
+
+/*
+ * Node of the k-d tree used for the nearest zone lookups; the locations are
+ * points on the unit sphere, so that the straight line distance between them
+ * orders them the same as the great circle one, and there is no special
+ * casing of the poles or the date line.
+ */
+typedef struct
+{
+  float   pos[3];
+  guint32 entry;
+} ZoneNearNode;
+
+#define EARTH_RADIUS_KM 6371.0
+
+/*
+ * Adds the relative paths of all the zone files under the directory dfd to the
+ * set; takes ownership of dfd.
+ *
+ * We do not descend into symlinked directories, and skip the posix/ and
+ * right/ trees, which only duplicate the main one and are not referenced from
+ * zone.tab.
+ */
+static void
+scan_zoneinfo_dir (int           dfd,
+                   GString      *prefix,
+                   GHashTable   *zones,
+                   GStringChunk *chunk)
+{
+  DIR           *dir;
+  struct dirent *de;
+  gsize          len = prefix->len;
+
+  if (!(dir = fdopendir (dfd)))
+    {
+      close (dfd);
+      return;
+    }
+
+  while ((de = readdir (dir)))
+    {
+      unsigned char type = de->d_type;
+      struct stat   st;
+
+      if (de->d_name[0] == '.')
+        continue;
+
+      if (!len && (!strcmp (de->d_name, "posix") ||
+                   !strcmp (de->d_name, "right")))
+        continue;
+
+      if (type == DT_UNKNOWN)
+        {
+          if (fstatat (dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+          if (S_ISDIR (st.st_mode))
+            type = DT_DIR;
+          else if (S_ISLNK (st.st_mode))
+            type = DT_LNK;
+          else if (S_ISREG (st.st_mode))
+            type = DT_REG;
+        }
+
+      /* links are fine as long as they point to a file */
+      if (type == DT_LNK)
+        {
+          if (fstatat (dfd, de->d_name, &st, 0) < 0 || !S_ISREG (st.st_mode))
+            continue;
+
+          type = DT_REG;
+        }
+
+      g_string_append (prefix, de->d_name);
+
+      if (type == DT_REG)
+        {
+          g_hash_table_add (zones, g_string_chunk_insert (chunk, prefix->str));
+        }
+      else if (type == DT_DIR)
+        {
+          int fd = openat (dfd, de->d_name,
+                           O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+          if (fd >= 0)
+            {
+              g_string_append_c (prefix, '/');
+              scan_zoneinfo_dir (fd, prefix, zones, chunk);
+            }
+        }
+
+      g_string_truncate (prefix, len);
+    }
+
+  closedir (dir);
+}
+
+static char *
+zone_file_path (const char *name)
+{
+  return g_build_filename (ZONE_ROOT, name, NULL);
+}
+
+static TzBundle *
+get_bundle (void)
+{
+  if (!bundle_opened && !bundle_disabled)
+    {
+      bundle = tzbundle_open (BUNDLE_PATH);
+      bundle_opened = TRUE;
+    }
+
+  return bundle;
+}
+
+static void
+reset_bundle (void)
+{
+  tzbundle_close (bundle);
+  bundle = NULL;
+  bundle_opened = FALSE;
+}
+
+static void
+stat_to_key (const struct stat *st, gint64 *mtime, guint64 *ino, guint64 *size)
+{
+  *mtime = (gint64)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+  *ino   = st->st_ino;
+  *size  = st->st_size;
+}
+
+/*
+ * Adds the directories leading to the zone files of the entries to the set;
+ * the entries are sorted, so a directory the previous zone is in has been
+ * added already.
+ */
+static void
+zone_dirs_add (GHashTable      *dirs,
+               const char      *strings,
+               const ZoneEntry *entries,
+               guint            n)
+{
+  const char *prev = NULL;
+  guint       i;
+
+  for (i = 0; i < n; i++)
+    {
+      const char *zone = strings + entries[i].zone;
+      const char *p;
+
+      for (p = strchr (zone, '/'); p; p = strchr (p + 1, '/'))
+        if (!prev || strncmp (prev, zone, p - zone + 1))
+          g_hash_table_add (dirs, g_strndup (zone, p - zone));
+
+      prev = zone;
+    }
+}
+
+/*
+ * Folds the stat data of the directories in the set into a single value; the
+ * values for the directories are summed, so the order does not matter.
+ */
+static guint64
+zone_dirs_stamp (GHashTable *dirs)
+{
+  GHashTableIter  iter;
+  gpointer        dir;
+  struct stat     st;
+  guint64         stamp = 0;
+
+  g_hash_table_iter_init (&iter, dirs);
+  while (g_hash_table_iter_next (&iter, &dir, NULL))
+    {
+      char    *path = zone_file_path (dir);
+      guint64  v = g_str_hash (dir);
+
+      if (!stat (path, &st))
+        v ^= ((guint64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec) ^
+          ((guint64)st.st_ino << 32);
+
+      stamp += v * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+      g_free (path);
+    }
+
+  return stamp;
+}
+
+static gboolean
+zone_cache_get_key (ZoneCacheKey *key)
+{
+  struct stat  st;
+  char        *path;
+  guint        i;
+
+  memset (key, 0, sizeof (*key));
+
+  if (get_bundle ())
+    {
+      for (i = 0; i < G_N_ELEMENTS (zone_tab_names); i++)
+        if (tzbundle_lookup (bundle, zone_tab_names[i], NULL))
+          break;
+
+      if (i == G_N_ELEMENTS (zone_tab_names) || stat (BUNDLE_PATH, &st) < 0)
+        return FALSE;
+
+      key->bundle   = TRUE;
+      key->tab_file = i;
+      stat_to_key (&st, &key->tab_mtime, &key->tab_ino, &key->tab_size);
+
+      return TRUE;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (zone_tab_names); i++)
+    {
+      int r;
+
+      path = zone_file_path (zone_tab_names[i]);
+      r = stat (path, &st);
+      g_free (path);
+
+      if (!r)
+        break;
+    }
+
+  if (i == G_N_ELEMENTS (zone_tab_names))
+    return FALSE;
+
+  key->tab_file = i;
+  stat_to_key (&st, &key->tab_mtime, &key->tab_ino, &key->tab_size);
+
+  /* the country names are optional */
+  path = zone_file_path (ISO3166_TAB);
+
+  if (!stat (path, &st))
+    stat_to_key (&st, &key->iso_mtime, &key->iso_ino, &key->iso_size);
+
+  g_free (path);
+
+  if (stat (ZONE_ROOT, &st) < 0)
+    return FALSE;
+
+  key->dir_mtime = (gint64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  key->dir_ino   = st.st_ino;
+
+  return TRUE;
+}
+
+static char *
+zone_cache_path (void)
+{
+  char *name, *path;
+
+  if (!zoneinfo_root)
+    return g_build_filename (g_get_user_cache_dir (), ZONE_CACHE_FILE, NULL);
+
+  /* keep the index of a relocated tree apart from the system one */
+  name = g_strdup_printf ("%s-%08x", ZONE_CACHE_FILE,
+                          g_str_hash (zoneinfo_root));
+  path = g_build_filename (g_get_user_cache_dir (), name, NULL);
+  g_free (name);
+
+  return path;
+}
+
+/*
+ * Points the table members at the block; returns FALSE if the block does not
+ * hold a consistent table.
+ */
+static gboolean
+zonetab_set_data (ZoneTab *tab, gpointer data, gsize size)
+{
+  const ZoneTabHeader *h = data;
+  const char          *strings;
+  guint32              i;
+
+  if (size < sizeof (ZoneTabHeader) ||
+      size != sizeof (ZoneTabHeader) +
+      ((gsize)h->n_entries + h->n_missing) * sizeof (ZoneEntry) +
+      (gsize)h->n_regions * sizeof (ZoneRegion) + h->strings_len ||
+      !h->strings_len)
+    return FALSE;
+
+  tab->entries   = (const ZoneEntry *)(h + 1);
+  tab->n_entries = h->n_entries;
+  tab->missing   = tab->entries + tab->n_entries;
+  tab->n_missing = h->n_missing;
+  tab->regions   = (const ZoneRegion *)(tab->missing + tab->n_missing);
+  tab->n_regions = h->n_regions;
+  tab->strings   = strings = (const char *)(tab->regions + tab->n_regions);
+
+  if (strings[h->strings_len - 1])
+    return FALSE;
+
+  /* the missing entries directly follow the present ones */
+  for (i = 0; i < tab->n_entries + tab->n_missing; i++)
+    {
+      const ZoneEntry *e = &tab->entries[i];
+
+      if (e->zone >= h->strings_len || e->region >= h->strings_len ||
+          e->city >= h->strings_len || e->country >= h->strings_len ||
+          e->country_name >= h->strings_len)
+        return FALSE;
+    }
+
+  for (i = 0; i < tab->n_regions; i++)
+    {
+      const ZoneRegion *r = &tab->regions[i];
+
+      if (r->name >= h->strings_len || r->first > tab->n_entries ||
+          r->n_entries > tab->n_entries - r->first)
+        return FALSE;
+    }
+
+  tab->data = data;
+  tab->size = size;
+
+  return TRUE;
+}
+
+static gboolean
+zone_cache_load (ZoneTab *tab, const ZoneCacheKey *key)
+{
+  const ZoneTabHeader *h;
+  char                *path;
+  struct stat          st;
+  void                *map = MAP_FAILED;
+  int                  fd;
+  gboolean             retval = FALSE;
+
+  path = zone_cache_path ();
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  g_free (path);
+
+  if (fd < 0)
+    return FALSE;
+
+  if (fstat (fd, &st) < 0 || st.st_size < (off_t)sizeof (ZoneTabHeader))
+    goto finish;
+
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    goto finish;
+
+  h = map;
+
+  if (h->magic != ZONE_CACHE_MAGIC || h->version != ZONE_CACHE_VERSION ||
+      memcmp (&h->key, key, sizeof (*key)))
+    goto finish;
+
+  if (!zonetab_set_data (tab, map, st.st_size))
+    goto finish;
+
+  if (!key->bundle)
+    {
+      GHashTable *dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, NULL);
+      guint64     stamp;
+
+      zone_dirs_add (dirs, tab->strings, tab->entries,
+                     tab->n_entries + tab->n_missing);
+      stamp = zone_dirs_stamp (dirs);
+      g_hash_table_destroy (dirs);
+
+      if (stamp != h->dirs_stamp)
+        goto finish;
+    }
+
+  tab->mapped = TRUE;
+  retval = TRUE;
+
+ finish:
+  if (!retval && map != MAP_FAILED)
+    munmap (map, st.st_size);
+
+  close (fd);
+
+  return retval;
+}
+
+/*
+ * Writes the index atomically, so a concurrent reader never sees a partial
+ * file; failure is not fatal, we just parse zone.tab again next time.
+ */
+static void
+zone_cache_save (const ZoneTab *tab)
+{
+  char *path, *tmp, *dir;
+  FILE *f;
+  int   ok;
+
+  path = zone_cache_path ();
+  tmp  = g_strconcat (path, ".tmp", NULL);
+
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  if (!(f = fopen (tmp, "w")))
+    {
+      g_debug ("Failed to open '%s': %s", tmp, strerror (errno));
+      goto finish;
+    }
+
+  ok = (fwrite (tab->data, tab->size, 1, f) == 1);
+
+  if (fclose (f) || !ok || rename (tmp, path))
+    {
+      g_debug ("Failed to write '%s': %s", path, strerror (errno));
+      unlink (tmp);
+    }
+
+ finish:
+  g_free (tmp);
+  g_free (path);
+}
+
+static int
+zone_record_cmp (gconstpointer a, gconstpointer b, gpointer strings)
+{
+  const ZoneRecord *r1 = a;
+  const ZoneRecord *r2 = b;
+
+  return strcmp ((const char *)strings + r1->zone,
+                 (const char *)strings + r2->zone);
+}
+
+static guint32
+pool_add (GString *pool, const char *s, gsize len)
+{
+  guint32 offset = pool->len;
+
+  g_string_append_len (pool, s, len);
+  g_string_append_c (pool, 0);
+
+  return offset;
+}
+
+/*
+ * Turns the parsed records into the table block; the records get sorted by
+ * zone name, which makes the cities of each region contiguous. Records for
+ * which we have no zone file go into the missing array.
+ */
+static void
+zonetab_build (ZoneTab            *tab,
+               const ZoneCacheKey *key,
+               GArray             *records,
+               GString            *pool)
+{
+  ZoneTabHeader  h = {0,};
+  GArray        *entries;
+  GArray        *missing;
+  GArray        *regions;
+  GString       *name;
+  ZoneRegion    *region = NULL;
+  guint          i;
+  gsize          size;
+  char          *data, *p;
+
+  g_array_sort_with_data (records, zone_record_cmp, pool->str);
+
+  entries = g_array_sized_new (FALSE, FALSE, sizeof (ZoneEntry), records->len);
+  missing = g_array_new (FALSE, FALSE, sizeof (ZoneEntry));
+  regions = g_array_new (FALSE, FALSE, sizeof (ZoneRegion));
+  name    = g_string_new (NULL);
+
+  for (i = 0; i < records->len; i++)
+    {
+      ZoneRecord *r = &g_array_index (records, ZoneRecord, i);
+      ZoneEntry   e;
+      char       *p, *city;
+
+      e.zone         = r->zone;
+      e.country      = r->country;
+      e.country_name = r->country_name;
+      e.lat          = r->lat;
+      e.lon          = r->lon;
+
+      if (!r->present)
+        {
+          e.region = e.city = 0;
+          g_array_append_val (missing, e);
+          continue;
+        }
+
+      /* the pool may move as we add to it, so work on a copy of the zone */
+      g_string_assign (name, pool->str + r->zone);
+
+      /* replace underscores with spaces */
+      for (p = name->str; *p; p++)
+        if (*p == '_')
+          *p = ' ';
+
+      if ((city = strchr (name->str, '/')))
+        *city++ = 0;
+
+      if (!region || strcmp (pool->str + region->name, name->str))
+        {
+          ZoneRegion nr;
+
+          nr.name      = pool_add (pool, name->str, strlen (name->str));
+          nr.first     = entries->len;
+          nr.n_entries = 0;
+
+          g_array_append_val (regions, nr);
+          region = &g_array_index (regions, ZoneRegion, regions->len - 1);
+        }
+
+      e.region  = region->name;
+      e.city    = city ? pool_add (pool, city, strlen (city)) : 0;
+
+      g_array_append_val (entries, e);
+      region->n_entries++;
+    }
+
+  h.magic       = ZONE_CACHE_MAGIC;
+  h.version     = ZONE_CACHE_VERSION;
+  h.key         = *key;
+  h.n_entries   = entries->len;
+  h.n_missing   = missing->len;
+  h.n_regions   = regions->len;
+  h.strings_len = pool->len;
+
+  if (!key->bundle)
+    {
+      GHashTable *dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, NULL);
+
+      zone_dirs_add (dirs, pool->str, (const ZoneEntry *)entries->data,
+                     entries->len);
+      zone_dirs_add (dirs, pool->str, (const ZoneEntry *)missing->data,
+                     missing->len);
+      h.dirs_stamp = zone_dirs_stamp (dirs);
+      g_hash_table_destroy (dirs);
+    }
+
+  size = sizeof (h) + (entries->len + missing->len) * sizeof (ZoneEntry) +
+    regions->len * sizeof (ZoneRegion) + pool->len;
+
+  data = g_malloc (size);
+  p    = data;
+
+  memcpy (p, &h, sizeof (h));
+  p += sizeof (h);
+  memcpy (p, entries->data, entries->len * sizeof (ZoneEntry));
+  p += entries->len * sizeof (ZoneEntry);
+  memcpy (p, missing->data, missing->len * sizeof (ZoneEntry));
+  p += missing->len * sizeof (ZoneEntry);
+  memcpy (p, regions->data, regions->len * sizeof (ZoneRegion));
+  p += regions->len * sizeof (ZoneRegion);
+  memcpy (p, pool->str, pool->len);
+
+  zonetab_set_data (tab, data, size);
+
+  g_array_free (entries, TRUE);
+  g_array_free (missing, TRUE);
+  g_array_free (regions, TRUE);
+  g_string_free (name, TRUE);
+}
+
+/*
+ * Parses one half of an ISO 6709 location, i.e., sign, deg_digits of degrees,
+ * two digits of minutes and optionally two of seconds.
+ */
+static gboolean
+parse_iso6709_angle (const char *s, gsize len, int deg_digits, gint32 *angle)
+{
+  int   v[3] = {0,};
+  int   i, n;
+  gsize j;
+
+  if (len != deg_digits + 3 && len != deg_digits + 5)
+    return FALSE;
+
+  if (s[0] != '+' && s[0] != '-')
+    return FALSE;
+
+  for (j = 1; j < len; j++)
+    if (!isdigit (s[j]))
+      return FALSE;
+
+  for (i = 0, j = 1; j < len; i++, j += n)
+    {
+      int k;
+
+      n = i ? 2 : deg_digits;
+
+      for (k = 0; k < n; k++)
+        v[i] = v[i] * 10 + (s[j + k] - '0');
+    }
+
+  *angle = v[0] * 3600 + v[1] * 60 + v[2];
+
+  if (s[0] == '-')
+    *angle = -*angle;
+
+  return TRUE;
+}
+
+/*
+ * Parses zone.tab coordinates, +DDMM+DDDMM or +DDMMSS+DDDMMSS.
+ */
+static gboolean
+parse_iso6709 (const char *coords, gsize len, gint32 *lat, gint32 *lon)
+{
+  gsize i;
+
+  for (i = 1; i < len && coords[i] != '+' && coords[i] != '-'; i++);
+
+  if (i == len)
+    return FALSE;
+
+  return parse_iso6709_angle (coords, i, 2, lat) &&
+    parse_iso6709_angle (coords + i, len - i, 3, lon);
+}
+
+/*
+ * Returns the contents of a file of the zoneinfo tree, from the bundle if we
+ * have one, or mapped from the tree; release with zonetab_unmap_file().
+ */
+gconstpointer
+zonetab_map_file (const char *name, gsize *len)
+{
+  struct stat  st;
+  char        *path;
+  void        *map = NULL;
+  int          fd;
+
+  if (get_bundle ())
+    return tzbundle_lookup (bundle, name, len);
+
+  path = zone_file_path (name);
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  g_free (path);
+
+  if (fd < 0)
+    return NULL;
+
+  if (!fstat (fd, &st) && st.st_size > 0)
+    {
+      map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (map == MAP_FAILED)
+        map = NULL;
+      else
+        *len = st.st_size;
+    }
+
+  close (fd);
+
+  return map;
+}
+
+void
+zonetab_unmap_file (gconstpointer data, gsize len)
+{
+  if (data && !tzbundle_contains (bundle, data))
+    munmap ((void *) data, len);
+}
+
+gboolean
+zonetab_has_bundle (void)
+{
+  return get_bundle () != NULL;
+}
+
+/*
+ * Points the zone data at a bundle other than the default one, or disables
+ * the use of a bundle if path is NULL; must be called before any table is
+ * loaded.
+ */
+void
+zonetab_set_bundle (const char *path)
+{
+  reset_bundle ();
+  g_free (bundle_path);
+
+  bundle_path     = g_strdup (path);
+  bundle_disabled = !path;
+}
+
+/*
+ * The tab files are parsed in place in the mapped file; the fields are
+ * located with memchr() and only the bits we keep are copied, into the string
+ * pool.
+ */
+/*
+ * Returns the end of the line starting at p; comment lines are returned as
+ * empty.
+ */
+static const char *
+next_line (const char *p, const char *end, const char **line_end)
+{
+  const char *nl = memchr (p, '\n', end - p);
+
+  *line_end = nl ? nl : end;
+
+  if (*p == '#')
+    *line_end = p;
+
+  return nl ? nl + 1 : end;
+}
+
+/*
+ * Splits the next tab separated field off the line.
+ */
+static gsize
+next_field (const char **p, const char *end, const char **field)
+{
+  const char *tab = memchr (*p, '\t', end - *p);
+  gsize       len;
+
+  *field = *p;
+
+  if (tab)
+    {
+      len = tab - *p;
+      *p  = tab + 1;
+    }
+  else
+    {
+      len = end - *p;
+      *p  = end;
+    }
+
+  return len;
+}
+
+/* countries are looked up by their code, which maps on 26 * 26 slots */
+#define COUNTRY_SLOTS (26 * 26)
+
+typedef struct
+{
+  const char *name;
+  guint32     len;
+  guint32     offset;  /* in the string pool, 0 until first used */
+} CountryName;
+
+static int
+country_slot (const char *code, gsize len)
+{
+  if (len != 2 || !g_ascii_isupper (code[0]) || !g_ascii_isupper (code[1]))
+    return -1;
+
+  return (code[0] - 'A') * 26 + code[1] - 'A';
+}
+
+static void
+parse_iso3166 (const char *data, gsize len, CountryName *countries)
+{
+  const char *p = data;
+  const char *end = data + len;
+
+  while (p < end)
+    {
+      const char *line, *line_end, *code, *name;
+      gsize       code_len, name_len;
+      int         slot;
+
+      line = p;
+      p = next_line (p, end, &line_end);
+
+      if (line_end == line)
+        continue;
+
+      code_len = next_field (&line, line_end, &code);
+      name_len = next_field (&line, line_end, &name);
+
+      if ((slot = country_slot (code, code_len)) >= 0 && name_len)
+        {
+          countries[slot].name = name;
+          countries[slot].len  = name_len;
+        }
+    }
+}
+
+/*
+ * Adds the names of the comma separated countries to the pool, joined with
+ * '/'; codes without a name are used as they are.
+ */
+static guint32
+pool_add_countries (GString     *pool,
+                    const char  *codes,
+                    gsize        len,
+                    CountryName *countries)
+{
+  const char *end = codes + len;
+  const char *comma;
+  guint32     offset = pool->len;
+  int         slot;
+
+  /* the common single country case shares the name */
+  if (len == 2 && (slot = country_slot (codes, len)) >= 0 &&
+      countries[slot].name)
+    {
+      if (!countries[slot].offset)
+        countries[slot].offset =
+          pool_add (pool, countries[slot].name, countries[slot].len);
+
+      return countries[slot].offset;
+    }
+
+  while (codes < end)
+    {
+      if (!(comma = memchr (codes, ',', end - codes)))
+        comma = end;
+
+      if (pool->len > offset)
+        g_string_append_c (pool, '/');
+
+      slot = country_slot (codes, comma - codes);
+
+      if (slot >= 0 && countries[slot].name)
+        g_string_append_len (pool, countries[slot].name, countries[slot].len);
+      else
+        g_string_append_len (pool, codes, comma - codes);
+
+      codes = comma + 1;
+    }
+
+  g_string_append_c (pool, 0);
+
+  return offset;
+}
+
+static void
+parse_zone_tab (ZoneTab *tab, const ZoneCacheKey *key)
+{
+  const char   *data, *iso, *p, *end;
+  gsize         len = 0, iso_len = 0;
+  CountryName   countries[COUNTRY_SLOTS];
+  GArray       *records;
+  GString      *pool;
+  GString      *prefix;
+  GHashTable   *zones = NULL;
+  GStringChunk *chunk = NULL;
+  int           dfd;
+
+  records = g_array_new (FALSE, FALSE, sizeof (ZoneRecord));
+
+  /* offset 0 holds the empty string */
+  pool = g_string_new (NULL);
+  g_string_append_c (pool, 0);
+
+  if (!(data = zonetab_map_file (zone_tab_names[key->tab_file], &len)))
+    {
+      g_warning ("Failed to open %s: %s",
+                 zone_tab_names[key->tab_file], strerror (errno));
+      goto finish;
+    }
+
+  memset (countries, 0, sizeof (countries));
+
+  if ((iso = zonetab_map_file (ISO3166_TAB, &iso_len)))
+    parse_iso3166 (iso, iso_len, countries);
+
+  /*
+   * Collect the zone files that are actually present in one walk of the
+   * zoneinfo tree, rather than stat()ing the file for each entry; the bundle
+   * has its own index.
+   */
+  if (!key->bundle)
+    {
+      zones  = g_hash_table_new (g_str_hash, g_str_equal);
+      chunk  = g_string_chunk_new (4096);
+      prefix = g_string_new (NULL);
+
+      if ((dfd = open (ZONE_ROOT, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0)
+        scan_zoneinfo_dir (dfd, prefix, zones, chunk);
+      else
+        g_warning ("Failed to open %s: %s", ZONE_ROOT, strerror (errno));
+
+      g_string_free (prefix, TRUE);
+    }
+
+  for (p = data, end = data + len; p < end;)
+    {
+      const char *line, *line_end, *codes, *coords, *zone;
+      gsize       codes_len, coords_len, zone_len;
+      ZoneRecord  r;
+
+      line = p;
+      p = next_line (p, end, &line_end);
+
+      if (line_end == line)
+        continue;
+
+      codes_len  = next_field (&line, line_end, &codes);
+      coords_len = next_field (&line, line_end, &coords);
+      zone_len   = next_field (&line, line_end, &zone);
+
+      if (!codes_len || !coords_len || !zone_len)
+        continue;
+
+      r.zone = pool_add (pool, zone, zone_len);
+
+      /*
+       * Make sure we have the actual zone info here, since Poky prunes the
+       * data without prooning the zones.tab
+       */
+      if (zones)
+        r.present = g_hash_table_contains (zones, pool->str + r.zone);
+      else
+        r.present = tzbundle_lookup (bundle, pool->str + r.zone, NULL) != NULL;
+
+      if (!parse_iso6709 (coords, coords_len, &r.lat, &r.lon))
+        r.lat = r.lon = 0;
+
+      r.country      = pool_add (pool, codes, codes_len);
+      r.country_name = pool_add_countries (pool, codes, codes_len, countries);
+      g_array_append_val (records, r);
+    }
+
+  zonetab_unmap_file (data, len);
+  zonetab_unmap_file (iso, iso_len);
+
+  if (zones)
+    {
+      g_hash_table_destroy (zones);
+      g_string_chunk_free (chunk);
+    }
+
+ finish:
+  zonetab_build (tab, key, records, pool);
+
+  g_array_free (records, TRUE);
+  g_string_free (pool, TRUE);
+}
+
+/*
+ * Relocates the zoneinfo tree, e.g., for benchmarking against generated data;
+ * needs to be called before any table is loaded.
+ */
+void
+zonetab_set_root (const char *dir)
+{
+  g_free (zoneinfo_root);
+
+  zoneinfo_root = g_strdup (dir);
+}
+
+const char *
+zonetab_get_root (void)
+{
+  return ZONE_ROOT;
+}
+
+/*
+ * Loads the zone table, from the on-disk index if it is up to date, or from
+ * zone.tab otherwise.
+ */
+ZoneTab *
+zonetab_new (void)
+{
+  ZoneTab      *tab = g_slice_new0 (ZoneTab);
+  ZoneCacheKey  key;
+
+  tab->ref_count = 1;
+
+  if (!zone_cache_get_key (&key))
+    g_warning ("Failed to stat the zone list: %s", strerror (errno));
+  else if (zone_cache_load (tab, &key))
+    return tab;
+
+  parse_zone_tab (tab, &key);
+
+  if (key.tab_ino)
+    zone_cache_save (tab);
+
+  return tab;
+}
+
+/*
+ * Creates a copy of the table with the zones in the changes hash (zone name
+ * to GINT_TO_POINTER (present)) moved in or out of the missing array.
+ */
+static ZoneTab *
+zonetab_new_with_changes (const ZoneTab *old, GHashTable *changes)
+{
+  ZoneTab      *tab = g_slice_new0 (ZoneTab);
+  ZoneCacheKey  key;
+  GArray       *records;
+  GString      *pool;
+  guint         i;
+
+  tab->ref_count = 1;
+
+  records = g_array_sized_new (FALSE, FALSE, sizeof (ZoneRecord),
+                               old->n_entries + old->n_missing);
+  pool = g_string_new (NULL);
+  g_string_append_c (pool, 0);
+
+  for (i = 0; i < old->n_entries + old->n_missing; i++)
+    {
+      const ZoneEntry *e = &old->entries[i];
+      const char      *zone = ZONE_STR (old, e->zone);
+      const char      *country = ZONE_STR (old, e->country);
+      const char      *name = ZONE_STR (old, e->country_name);
+      ZoneRecord       r;
+      gpointer         present;
+
+      r.zone         = pool_add (pool, zone, strlen (zone));
+      r.country      = pool_add (pool, country, strlen (country));
+      r.country_name = pool_add (pool, name, strlen (name));
+      r.lat          = e->lat;
+      r.lon          = e->lon;
+      r.present      = (i < old->n_entries);
+
+      if (g_hash_table_lookup_extended (changes, zone, NULL, &present))
+        r.present = GPOINTER_TO_INT (present);
+
+      g_array_append_val (records, r);
+    }
+
+  zone_cache_get_key (&key);
+  zonetab_build (tab, &key, records, pool);
+
+  if (key.tab_ino)
+    zone_cache_save (tab);
+
+  g_array_free (records, TRUE);
+  g_string_free (pool, TRUE);
+
+  return tab;
+}
+
+ZoneTab *
+zonetab_ref (ZoneTab *tab)
+{
+  tab->ref_count++;
+
+  return tab;
+}
+
+void
+zonetab_unref (ZoneTab *tab)
+{
+  if (!tab || --tab->ref_count)
+    return;
+
+  g_free (tab->near_index);
+
+  if (tab->mapped)
+    munmap (tab->data, tab->size);
+  else
+    g_free (tab->data);
+
+  g_slice_free (ZoneTab, tab);
+}
+
+/*
+ * The shared table returned by zonetab_get() is kept up to date with the
+ * filesystem via file monitors on zone.tab and the zoneinfo directories. A
+ * change of zone.tab means a full reload; for any other changes we only
+ * recheck the affected zones and rebuild the table from the current one.
+ *
+ * The changes are processed from an idle callback, so that a tzdata update
+ * does not trigger a rebuild for every single file.
+ */
+static ZoneTab    *live_tab = NULL;
+static GFile      *live_root = NULL;
+static GPtrArray  *live_monitors = NULL;
+static GHashTable *live_pending = NULL;
+static gboolean    live_reload = FALSE;
+static guint       live_idle_id = 0;
+
+static void live_monitors_start (void);
+
+static const ZoneEntry *
+find_entry (const ZoneTab   *tab,
+            const ZoneEntry *entries,
+            guint            n,
+            const char      *zone)
+{
+  guint lo = 0;
+  guint hi = n;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      int   c   = strcmp (zone, ZONE_STR (tab, entries[mid].zone));
+
+      if (!c)
+        return &entries[mid];
+
+      if (c < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return NULL;
+}
+
+static gboolean
+live_idle_cb (gpointer data)
+{
+  ZoneTab        *tab = NULL;
+  GHashTableIter  iter;
+  gpointer        zone, present;
+  gboolean        changed = FALSE;
+
+  live_idle_id = 0;
+
+  if (live_reload)
+    {
+      live_reload = FALSE;
+      g_hash_table_remove_all (live_pending);
+      tzfile_forget (NULL);
+      reset_bundle ();
+
+      tab = zonetab_new ();
+      live_monitors_start ();
+    }
+  else
+    {
+      /* revalidate only the zones we have been notified about */
+      g_hash_table_iter_init (&iter, live_pending);
+      while (g_hash_table_iter_next (&iter, &zone, &present))
+        {
+          char        *path = g_build_filename (ZONE_ROOT, zone, NULL);
+          struct stat  st;
+          gboolean     exists;
+
+          exists = (stat (path, &st) == 0 && S_ISREG (st.st_mode));
+          g_free (path);
+          tzfile_forget (zone);
+
+          if (exists != !!zonetab_find (live_tab, zone))
+            changed = TRUE;
+
+          g_hash_table_iter_replace (&iter, GINT_TO_POINTER (exists));
+        }
+
+      if (changed)
+        tab = zonetab_new_with_changes (live_tab, live_pending);
+
+      g_hash_table_remove_all (live_pending);
+    }
+
+  if (tab)
+    {
+      zonetab_unref (live_tab);
+      live_tab = tab;
+    }
+
+  return FALSE;
+}
+
+static void
+live_queue (void)
+{
+  if (!live_idle_id)
+    live_idle_id = g_idle_add (live_idle_cb, NULL);
+}
+
+static void
+live_zone_tab_changed_cb (GFileMonitor      *monitor,
+                          GFile             *file,
+                          GFile             *other,
+                          GFileMonitorEvent  event,
+                          gpointer           data)
+{
+  if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+      event == G_FILE_MONITOR_EVENT_CREATED ||
+      event == G_FILE_MONITOR_EVENT_DELETED)
+    {
+      live_reload = TRUE;
+      live_queue ();
+    }
+}
+
+static void
+live_dir_changed_cb (GFileMonitor      *monitor,
+                     GFile             *file,
+                     GFile             *other,
+                     GFileMonitorEvent  event,
+                     gpointer           data)
+{
+  char *zone;
+
+  if (event != G_FILE_MONITOR_EVENT_CREATED &&
+      event != G_FILE_MONITOR_EVENT_DELETED &&
+      event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+    return;
+
+  if (!(zone = g_file_get_relative_path (live_root, file)))
+    return;
+
+  /* we only care about the zones listed in zone.tab */
+  if (find_entry (live_tab, live_tab->entries, live_tab->n_entries, zone) ||
+      find_entry (live_tab, live_tab->missing, live_tab->n_missing, zone))
+    {
+      g_hash_table_replace (live_pending, zone, NULL);
+      live_queue ();
+    }
+  else
+    g_free (zone);
+}
+
+static void
+live_monitor_add (GFile *file, gboolean is_dir)
+{
+  GFileMonitor *monitor;
+  GError       *error = NULL;
+
+  if (is_dir)
+    monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL,
+                                        &error);
+  else
+    monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error);
+
+  if (!monitor)
+    {
+      g_debug ("Failed to monitor zoneinfo: %s", error->message);
+      g_clear_error (&error);
+      return;
+    }
+
+  g_signal_connect (monitor, "changed",
+                    is_dir ? G_CALLBACK (live_dir_changed_cb) :
+                    G_CALLBACK (live_zone_tab_changed_cb),
+                    NULL);
+
+  g_ptr_array_add (live_monitors, monitor);
+}
+
+/*
+ * Sets up monitors for the tab files and all the directories that hold zones
+ * listed in them (directory monitors are not recursive).
+ */
+static void
+live_monitors_start (void)
+{
+  GHashTable     *dirs;
+  GHashTableIter  iter;
+  gpointer        dir;
+  GFile          *file;
+  guint           i;
+
+  if (live_monitors)
+    g_ptr_array_free (live_monitors, TRUE);
+
+  live_monitors = g_ptr_array_new_with_free_func (g_object_unref);
+
+  if (!live_root)
+    live_root = g_file_new_for_path (ZONE_ROOT);
+
+  if (!bundle_disabled)
+    {
+      file = g_file_new_for_path (BUNDLE_PATH);
+      live_monitor_add (file, FALSE);
+      g_object_unref (file);
+
+      /* nothing else is used with the bundle */
+      if (get_bundle ())
+        return;
+    }
+
+  /* all of the zone lists, in case the preferred one appears */
+  for (i = 0; i < G_N_ELEMENTS (zone_tab_names); i++)
+    {
+      file = g_file_get_child (live_root, zone_tab_names[i]);
+      live_monitor_add (file, FALSE);
+      g_object_unref (file);
+    }
+
+  file = g_file_get_child (live_root, ISO3166_TAB);
+  live_monitor_add (file, FALSE);
+  g_object_unref (file);
+
+  dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  /* the missing entries directly follow the present ones */
+  for (i = 0; i < live_tab->n_entries + live_tab->n_missing; i++)
+    {
+      const char *zone = ZONE_STR (live_tab, live_tab->entries[i].zone);
+      const char *p    = strrchr (zone, '/');
+
+      g_hash_table_add (dirs, p ? g_strndup (zone, p - zone) : g_strdup (""));
+    }
+
+  g_hash_table_add (dirs, g_strdup (""));
+
+  g_hash_table_iter_init (&iter, dirs);
+  while (g_hash_table_iter_next (&iter, &dir, NULL))
+    {
+      file = *(char *)dir ? g_file_get_child (live_root, dir) :
+        g_object_ref (live_root);
+      live_monitor_add (file, TRUE);
+      g_object_unref (file);
+    }
+
+  g_hash_table_destroy (dirs);
+}
+
+/*
+ * Returns the shared zone table; the table is replaced when the zoneinfo data
+ * changes, so take a reference if you need it to outlive the current main
+ * loop iteration.
+ */
+ZoneTab *
+zonetab_get (void)
+{
+  if (!live_tab)
+    {
+      live_tab     = zonetab_new ();
+      live_pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, NULL);
+      live_monitors_start ();
+    }
+
+  return live_tab;
+}
+
+/*
+ * Binary search of the table by zone name.
+ */
+const ZoneEntry *
+zonetab_find (const ZoneTab *tab, const char *zone)
+{
+  return find_entry (tab, tab->entries, tab->n_entries, zone);
+}
+
+/*
+ * Since the entries are sorted, the zones starting with prefix form a range of
+ * the entry array; returns the number of matching entries, and the index of
+ * the first one in first.
+ */
+guint
+zonetab_find_prefix (const ZoneTab *tab, const char *prefix, guint *first)
+{
+  gsize len = strlen (prefix);
+  guint lo  = 0;
+  guint hi  = tab->n_entries;
+  guint start;
+
+  /* first entry >= prefix */
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (strcmp (ZONE_STR (tab, tab->entries[mid].zone), prefix) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  start = lo;
+  hi    = tab->n_entries;
+
+  /* first entry past start not starting with prefix */
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (strncmp (ZONE_STR (tab, tab->entries[mid].zone), prefix, len) <= 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (first)
+    *first = start;
+
+  return lo - start;
+}
+
+static void
+location_to_point (double lat, double lon, float *pos)
+{
+  lat *= G_PI / 180.0;
+  lon *= G_PI / 180.0;
+
+  pos[0] = cos (lat) * cos (lon);
+  pos[1] = cos (lat) * sin (lon);
+  pos[2] = sin (lat);
+}
+
+static int
+near_node_cmp (gconstpointer a, gconstpointer b, gpointer axis)
+{
+  float d = ((const ZoneNearNode *)a)->pos[GPOINTER_TO_INT (axis)] -
+    ((const ZoneNearNode *)b)->pos[GPOINTER_TO_INT (axis)];
+
+  return d < 0 ? -1 : d > 0;
+}
+
+/*
+ * Builds the subtree in nodes[lo, hi), with the median along axis at the
+ * middle of the range, the lesser nodes before and the greater after it.
+ *
+ * This is only done once per table, for a few hundred zones, so we simply
+ * sort each range rather than doing a proper median selection.
+ */
+static void
+near_index_build (ZoneNearNode *nodes, guint lo, guint hi, int axis)
+{
+  guint mid = lo + (hi - lo) / 2;
+
+  if (hi - lo < 2)
+    return;
+
+  g_qsort_with_data (nodes + lo, hi - lo, sizeof (ZoneNearNode),
+                     near_node_cmp, GINT_TO_POINTER (axis));
+
+  near_index_build (nodes, lo, mid, (axis + 1) % 3);
+  near_index_build (nodes, mid + 1, hi, (axis + 1) % 3);
+}
+
+typedef struct
+{
+  float  pos[3];
+  guint  k;
+  guint  n;
+  guint *entries;
+  float *dist;   /* squared, ascending */
+} ZoneNearQuery;
+
+static void
+near_index_search (const ZoneNearNode *nodes,
+                   guint               lo,
+                   guint               hi,
+                   int                 axis,
+                   ZoneNearQuery      *q)
+{
+  const ZoneNearNode *node;
+  guint               mid;
+  float               d, diff;
+  int                 i;
+
+  if (lo >= hi)
+    return;
+
+  mid  = lo + (hi - lo) / 2;
+  node = &nodes[mid];
+
+  d = (node->pos[0] - q->pos[0]) * (node->pos[0] - q->pos[0]) +
+    (node->pos[1] - q->pos[1]) * (node->pos[1] - q->pos[1]) +
+    (node->pos[2] - q->pos[2]) * (node->pos[2] - q->pos[2]);
+
+  if (q->n < q->k || d < q->dist[q->n - 1])
+    {
+      /* insert into the sorted result list, dropping the worst one if full */
+      i = MIN (q->n, q->k - 1);
+
+      while (i > 0 && q->dist[i - 1] > d)
+        {
+          q->dist[i]    = q->dist[i - 1];
+          q->entries[i] = q->entries[i - 1];
+          i--;
+        }
+
+      q->dist[i]    = d;
+      q->entries[i] = node->entry;
+
+      if (q->n < q->k)
+        q->n++;
+    }
+
+  diff = q->pos[axis] - node->pos[axis];
+
+  if (diff < 0)
+    {
+      near_index_search (nodes, lo, mid, (axis + 1) % 3, q);
+
+      if (q->n < q->k || diff * diff < q->dist[q->n - 1])
+        near_index_search (nodes, mid + 1, hi, (axis + 1) % 3, q);
+    }
+  else
+    {
+      near_index_search (nodes, mid + 1, hi, (axis + 1) % 3, q);
+
+      if (q->n < q->k || diff * diff < q->dist[q->n - 1])
+        near_index_search (nodes, lo, mid, (axis + 1) % 3, q);
+    }
+}
+
+/*
+ * Finds up to k zones nearest to the given location, in degrees; the indices
+ * of the entries are stored in entries, nearest first, and their distances in
+ * km in distances, if not NULL. Returns the number of zones found.
+ *
+ * The spatial index is built on the first call.
+ */
+guint
+zonetab_find_nearest (ZoneTab *tab,
+                      double   lat,
+                      double   lon,
+                      guint    k,
+                      guint   *entries,
+                      double  *distances)
+{
+  ZoneNearNode  *nodes;
+  ZoneNearQuery  q;
+  guint          i;
+
+  if (!k || !tab->n_entries)
+    return 0;
+
+  if (!(nodes = tab->near_index))
+    {
+      nodes = tab->near_index = g_new (ZoneNearNode, tab->n_entries);
+
+      for (i = 0; i < tab->n_entries; i++)
+        {
+          location_to_point (tab->entries[i].lat / 3600.0,
+                             tab->entries[i].lon / 3600.0,
+                             nodes[i].pos);
+          nodes[i].entry = i;
+        }
+
+      near_index_build (nodes, 0, tab->n_entries, 0);
+    }
+
+  location_to_point (lat, lon, q.pos);
+  q.k       = k;
+  q.n       = 0;
+  q.entries = entries;
+  q.dist    = g_new (float, k);
+
+  near_index_search (nodes, 0, tab->n_entries, 0, &q);
+
+  if (distances)
+    for (i = 0; i < q.n; i++)
+      distances[i] =
+        2.0 * EARTH_RADIUS_KM * asin (MIN (1.0, sqrt (q.dist[i]) / 2.0));
+
+  g_free (q.dist);
+
+  return q.n;
+}
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2012, sleep(5) ltd <http://sleepfive.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Author: Tomas Frydrych <tomas@sleepfive.com>
+ */
+
+#ifndef GUACA_ZONETAB_H
+#define GUACA_ZONETAB_H
+
+#include <glib.h>
+
+#define ZONEINFO_DIR "/usr/share/zoneinfo"
+
+/* packed tzdata used instead of the tree when present, see tzbundle.h */
+#define ZONE_BUNDLE  "/usr/share/guacamayo/tzdata.bundle"
+
+/*
+ * The zone table is a single block of memory holding an array of entries
+ * sorted by zone name, an array of regions, and a pool of strings the two
+ * point into. Since the entries are sorted by zone, the cities of each region
+ * form a contiguous range of the entry array.
+ *
+ * Zones listed in zone.tab for which there is no zone file are kept in a
+ * separate missing array; these have no region or city.
+ *
+ * All the string members are offsets into the pool; use ZONE_STR() to get at
+ * the actual string.
+ */
+typedef struct
+{
+  guint32 zone;         /* Europe/London */
+  guint32 region;       /* Europe */
+  guint32 city;         /* London, with underscores replaced by spaces */
+  guint32 country;      /* GB, or a comma separated list of codes */
+  guint32 country_name; /* United Kingdom, '/' separated for multiple */
+  gint32  lat;          /* location in seconds of arc, north positive */
+  gint32  lon;          /* location in seconds of arc, east positive */
+} ZoneEntry;
+
+typedef struct
+{
+  guint32 name;
+  guint32 first;   /* index of the first entry of the region */
+  guint32 n_entries;
+} ZoneRegion;
+
+typedef struct
+{
+  const ZoneEntry  *entries;
+  guint             n_entries;
+
+  const ZoneEntry  *missing;
+  guint             n_missing;
+
+  const ZoneRegion *regions;
+  guint             n_regions;
+
+  const char       *strings;
+
+  /* < private > */
+  guint             ref_count;
+  gpointer          data;
+  gsize             size;
+  gboolean          mapped;
+
+  gpointer          near_index;
+} ZoneTab;
+
+#define ZONE_STR(tab,offset) ((tab)->strings + (offset))
+
+void             zonetab_set_root    (const char *dir);
+const char      *zonetab_get_root    (void);
+void             zonetab_set_bundle  (const char *path);
+gboolean         zonetab_has_bundle  (void);
+gconstpointer    zonetab_map_file    (const char *name, gsize *len);
+void             zonetab_unmap_file  (gconstpointer data, gsize len);
+ZoneTab         *zonetab_new         (void);
+ZoneTab         *zonetab_get         (void);
+ZoneTab         *zonetab_ref         (ZoneTab *tab);
+void             zonetab_unref       (ZoneTab *tab);
+const ZoneEntry *zonetab_find        (const ZoneTab *tab, const char *zone);
+guint            zonetab_find_prefix (const ZoneTab *tab,
+                                      const char    *prefix,
+                                      guint         *first);
+guint            zonetab_find_nearest (ZoneTab *tab,
+                                       double   lat,
+                                       double   lon,
+                                       guint    k,
+                                       guint   *entries,
+                                       double  *distances);
+
+#endif